@@ -0,0 +1,314 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Host side of the report benchmark (CONFIG_APP_BENCH).
+
+Reads the bridge's mouse reports from the HID device, timestamps their
+arrival and prints the achieved rate, the inter-arrival distribution
+and the reports missing from the 3-bit sequence number the firmware
+puts in the padding bits of the buttons byte.
+
+    pip install hidapi pyserial
+    python3 scripts/bench_host.py --serial /dev/ttyACM0
+
+With --serial the script sends 'b' on the console to start the run,
+otherwise start it by hand. After the run it sends 'B' and reads the
+per-report device timestamps (see src/bench.h), pairs them with the
+arrival times by report index and prints end-to-end latency and jitter:
+
+    generation -> endpoint write -> IN completion    device clock
+    IN completion -> report read here                host clock
+
+The two clocks are aligned by fitting offset and drift to the gaps
+between completion and arrival; delivery on the host is reported
+relative to the fastest one seen, as the true offset is unknown.
+
+For regression runs, --json saves the results and --baseline compares
+against a saved file, exiting with 2 if a latency grew beyond
+--tolerance. On Linux the user needs read access to the bridge's
+/dev/hidraw node.
+"""
+
+import argparse
+import json
+import struct
+import sys
+import time
+
+import hid
+
+VID = 0x1915
+PID = 0x520F
+
+# USB mouse report of the first peripheral, see usb_hid.h
+MOUSE_REPORT_ID = 3
+SEQ_SHIFT = 5
+SEQ_MASK = 0x07
+
+# Sample record, see src/bench.h
+RECORD_VERSION = 1
+RECORD_HEADER = struct.Struct("<2sBBIII")
+RECORD_SAMPLE = struct.Struct("<IHH")
+TIME_NONE = 0xFFFF
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1,
+                max(0, int(round(pct / 100.0 * len(sorted_values))) - 1))
+    return sorted_values[index]
+
+
+def summary(values):
+    """min/p50/p99/max/stdev of a list, in its unit"""
+    values = sorted(values)
+    if not values:
+        return None
+    mean = sum(values) / len(values)
+    stdev = (sum((v - mean) ** 2 for v in values) / len(values)) ** 0.5
+    return {
+        "count": len(values),
+        "min": values[0],
+        "p50": percentile(values, 50),
+        "p99": percentile(values, 99),
+        "max": values[-1],
+        "stdev": stdev,
+    }
+
+
+def crc16_kermit(data):
+    """Zephyr crc16_ccitt() with seed 0"""
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+
+def read_samples(port, timeout):
+    """Request the sample record, return (generated, samples) or None"""
+    port.reset_input_buffer()
+    port.write(b"B")
+
+    buf = b""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        buf += port.read(port.in_waiting or 1)
+
+        start = buf.find(b"BS")
+        while 0 <= start <= len(buf) - RECORD_HEADER.size:
+            _, version, _, _, generated, count = \
+                RECORD_HEADER.unpack_from(buf, start)
+            size = RECORD_HEADER.size + RECORD_SAMPLE.size * count + 2
+            if version == RECORD_VERSION:
+                if len(buf) < start + size:
+                    # Wait for the rest of the record
+                    break
+
+                record = buf[start:start + size]
+                (crc,) = struct.unpack_from("<H", record, size - 2)
+                if crc == crc16_kermit(record[:-2]):
+                    samples = [RECORD_SAMPLE.unpack_from(
+                        record, RECORD_HEADER.size + i * RECORD_SAMPLE.size)
+                        for i in range(count)]
+                    return generated, samples
+
+            start = buf.find(b"BS", start + 1)
+
+    return None
+
+
+def collect(dev, idle, timeout):
+    """Read reports until idle, return [(report index, arrival ns)]"""
+    arrivals = []
+    index = None
+    deadline = time.monotonic() + timeout
+
+    while True:
+        wait = idle if arrivals else max(deadline - time.monotonic(), 0)
+        data = dev.read(64, int(wait * 1000))
+        now = time.perf_counter_ns()
+
+        if not data:
+            break
+        if data[0] != MOUSE_REPORT_ID:
+            continue
+
+        seq = (data[1] >> SEQ_SHIFT) & SEQ_MASK
+        if index is None:
+            # The run starts at report 0, unless its start was missed
+            index = seq
+        else:
+            index += ((seq - index - 1) & SEQ_MASK) + 1
+        arrivals.append((index, now))
+
+    return arrivals
+
+
+def pair(arrivals, samples):
+    """End-to-end latencies in us from paired device and host times"""
+    points = []
+    for index, arrival_ns in arrivals:
+        if index >= len(samples):
+            break
+        gen_us, write_us, complete_us = samples[index]
+        if complete_us == TIME_NONE:
+            continue
+        points.append((gen_us, write_us, complete_us, arrival_ns / 1000.0))
+
+    if len(points) < 2:
+        return None
+
+    # Host arrival minus device completion, as a line over device time:
+    # the slope is the drift between the clocks, the offset is unknown
+    xs = [gen + complete for gen, _, complete, _ in points]
+    ys = [arrival - x for x, (_, _, _, arrival) in zip(xs, points)]
+    mean_x = sum(xs) / len(xs)
+    mean_y = sum(ys) / len(ys)
+    var_x = sum((x - mean_x) ** 2 for x in xs)
+    slope = sum((x - mean_x) * (y - mean_y) for x, y in zip(xs, ys)) / var_x \
+        if var_x else 0.0
+    residuals = [y - mean_y - slope * (x - mean_x) for x, y in zip(xs, ys)]
+    fastest = min(residuals)
+    delivery = [r - fastest for r in residuals]
+
+    return {
+        "drift_ppm": slope * 1e6,
+        "queue_us": summary([w for _, w, _, _ in points if w != TIME_NONE]),
+        "device_us": summary([c for _, _, c, _ in points]),
+        "delivery_us": summary(delivery),
+        "end_to_end_us": summary([c + d for (_, _, c, _), d
+                                  in zip(points, delivery)]),
+    }
+
+
+def print_summary(name, s, unit):
+    if s is None:
+        print(f"  {name:22s} -")
+        return
+    print(f"  {name:22s} p50 {s['p50']:8.1f}  p99 {s['p99']:8.1f}  "
+          f"max {s['max']:8.1f}  stdev {s['stdev']:7.1f} {unit}")
+
+
+def compare(results, baseline, tolerance):
+    """Return the latencies that grew by more than tolerance (fraction)"""
+    regressions = []
+    for key in ("queue_us", "device_us", "delivery_us", "end_to_end_us"):
+        new = (results.get("paired") or {}).get(key)
+        old = (baseline.get("paired") or {}).get(key)
+        if not new or not old:
+            continue
+        for stat in ("p50", "p99"):
+            # Small absolute changes are noise, not regressions
+            limit = old[stat] * (1 + tolerance) + 50
+            if new[stat] > limit:
+                regressions.append(f"{key} {stat}: {old[stat]:.1f} -> "
+                                   f"{new[stat]:.1f}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--serial", help="console port, sends 'b' to start the run "
+                        "and 'B' to read the device timestamps")
+    parser.add_argument("--idle", type=float, default=1.0,
+                        help="seconds without reports that end the run (default 1)")
+    parser.add_argument("--timeout", type=float, default=30.0,
+                        help="seconds to wait for the first report (default 30)")
+    parser.add_argument("--json", help="save the results to this file")
+    parser.add_argument("--baseline", help="compare against results saved with --json")
+    parser.add_argument("--tolerance", type=float, default=0.2,
+                        help="allowed latency growth over the baseline (default 0.2)")
+    args = parser.parse_args()
+
+    console = None
+    if args.serial:
+        import serial
+
+        console = serial.Serial(args.serial, 115200, timeout=0.1)
+
+    dev = hid.device()
+    dev.open(VID, PID)
+    dev.set_nonblocking(False)
+
+    if console:
+        console.reset_input_buffer()
+        console.write(b"b")
+
+    arrivals = collect(dev, args.idle, args.timeout)
+    dev.close()
+
+    if len(arrivals) < 2:
+        print("No benchmark reports received", file=sys.stderr)
+        return 1
+
+    times = [ns for _, ns in arrivals]
+    elapsed_s = (times[-1] - times[0]) / 1e9
+    gaps_ms = sorted((b - a) / 1e6 for a, b in zip(times, times[1:]))
+    missing = arrivals[-1][0] - arrivals[0][0] + 1 - len(arrivals)
+
+    print(f"Reports: {len(arrivals)} in {elapsed_s:.3f} s, "
+          f"{(len(arrivals) - 1) / elapsed_s:.0f} reports/s")
+    print(f"Missing (from sequence numbers): {missing}")
+    print("Inter-arrival (ms): "
+          f"min {gaps_ms[0]:.3f}  p50 {percentile(gaps_ms, 50):.3f}  "
+          f"p99 {percentile(gaps_ms, 99):.3f}  max {gaps_ms[-1]:.3f}")
+
+    # Whole-millisecond histogram, shows whether the host polls every 1 ms
+    buckets = {}
+    for gap in gaps_ms:
+        buckets[int(gap)] = buckets.get(int(gap), 0) + 1
+    for ms in sorted(buckets):
+        print(f"  {ms:3d}-{ms + 1:<3d} ms  {buckets[ms]}")
+
+    results = {
+        "reports": len(arrivals),
+        "missing": missing,
+        "rate": (len(arrivals) - 1) / elapsed_s,
+        "gap_ms": summary(gaps_ms),
+        "paired": None,
+    }
+
+    if console:
+        record = read_samples(console, timeout=5.0)
+        console.close()
+        if record is None:
+            print("No sample record received", file=sys.stderr)
+            return 1
+
+        generated, samples = record
+        paired = pair(arrivals, samples)
+        results["paired"] = paired
+
+        print(f"\nDevice timestamps: {len(samples)} of {generated} reports")
+        if paired is None:
+            print("  too few reports paired", file=sys.stderr)
+        else:
+            print(f"  clock drift {paired['drift_ppm']:.1f} ppm")
+            print_summary("generate->write", paired["queue_us"], "us")
+            print_summary("generate->complete", paired["device_us"], "us")
+            print_summary("complete->read (rel.)", paired["delivery_us"], "us")
+            print_summary("end to end", paired["end_to_end_us"], "us")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(results, json.load(f), args.tolerance)
+        if regressions:
+            print("\nRegressions against the baseline:")
+            for line in regressions:
+                print(f"  {line}")
+            return 2
+        print("\nNo regressions against the baseline.")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
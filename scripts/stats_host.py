@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+"""
+Polls the bridge's counters through the binary record sent for 'T' on
+the console (see src/app_stats.h) and prints the ones that changed.
+
+    pip install pyserial
+    python3 scripts/stats_host.py /dev/ttyACM0 --interval 1
+
+Log output on the console is skipped: the record is found by its 'AS'
+header and checked with its CRC.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+RECORD_VERSION = 1
+
+# enum app_stat order, see src/app_stats.h
+NAMES = [
+    "ble.connects",
+    "ble.disconnects",
+    "ble.notifications",
+    "ble.att_errors",
+    "ble.param_updates",
+    "bridge.received",
+    "bridge.forwarded",
+    "bridge.suppressed",
+    "bridge.coalesced",
+    "bridge.evicted",
+    "bridge.drop_usb",
+    "bridge.drop_unsupported",
+    "bridge.drop_pool",
+    "bridge.drop_queue",
+    "bridge.drop_other",
+    "usb.sent",
+    "usb.write_errors",
+    "usb.stale",
+    "usb.releases",
+    "usb.suspends",
+    "usb.wakeups",
+    "usb.timeouts",
+]
+
+
+def crc16_kermit(data):
+    """Zephyr crc16_ccitt() with seed 0"""
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+
+def read_record(port, timeout):
+    """Request one record, return (uptime_ms, values) or None"""
+    port.reset_input_buffer()
+    port.write(b"T")
+
+    buf = b""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        buf += port.read(port.in_waiting or 1)
+
+        start = buf.find(b"AS")
+        while 0 <= start <= len(buf) - 4:
+            version, count = buf[start + 2], buf[start + 3]
+            size = 4 + 4 + 4 * count + 2
+            if version == RECORD_VERSION:
+                if len(buf) < start + size:
+                    # Wait for the rest of the record
+                    break
+
+                record = buf[start:start + size]
+                (crc,) = struct.unpack_from("<H", record, size - 2)
+                if crc == crc16_kermit(record[:-2]):
+                    uptime, *values = struct.unpack_from(f"<I{count}I", record, 4)
+                    return uptime, values
+
+            start = buf.find(b"AS", start + 1)
+
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="console port, e.g. /dev/ttyACM0")
+    parser.add_argument("--interval", type=float, default=1.0,
+                        help="seconds between polls (default 1)")
+    parser.add_argument("--once", action="store_true",
+                        help="print every counter once and exit")
+    args = parser.parse_args()
+
+    previous = None
+
+    with serial.Serial(args.port, 115200, timeout=0.1) as port:
+        while True:
+            result = read_record(port, timeout=2.0)
+            if result is None:
+                print("No valid record received", file=sys.stderr)
+                return 1
+
+            uptime, values = result
+            names = NAMES + [f"stat{i}" for i in range(len(NAMES), len(values))]
+
+            if args.once:
+                for name, value in zip(names, values):
+                    print(f"{name:26s} {value:10d}")
+                return 0
+
+            if previous is not None:
+                changes = [f"{name} +{value - old}"
+                           for name, value, old in zip(names, values, previous)
+                           if value != old]
+                print(f"{uptime / 1000:10.3f} s  " + (", ".join(changes) or "-"))
+            previous = values
+
+            time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
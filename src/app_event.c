@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <zephyr/kernel.h>
+
+#include "app_event.h"
+
+static K_EVENT_DEFINE(app_events);
+
+void app_event_post(uint32_t events)
+{
+	k_event_post(&app_events, events);
+}
+
+uint32_t app_event_wait(void)
+{
+	uint32_t events;
+
+	events = k_event_wait(&app_events, UINT32_MAX, false, K_FOREVER);
+
+	/* Only clear what was seen, later posts wake the next wait */
+	k_event_clear(&app_events, events);
+
+	return events;
+}
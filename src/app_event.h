@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef APP_EVENT_H_
+#define APP_EVENT_H_
+
+#include <stdint.h>
+#include <zephyr/sys/util.h>
+
+/*
+ * Events posted by the Bluetooth, pairing and console paths to wake the
+ * main thread. Events are bits: several posts of the same event before
+ * main runs are seen once, so receivers re-read the current state
+ * instead of counting events.
+ */
+enum app_event {
+	/* Link to a keyboard established */
+	APP_EVENT_CONNECTED = BIT(0),
+	/* Link to the keyboard lost */
+	APP_EVENT_DISCONNECTED = BIT(1),
+	/* Input reports subscribed, keystrokes are being forwarded */
+	APP_EVENT_HID_READY = BIT(2),
+	/* Passkey shown, waiting for it to be typed on the keyboard */
+	APP_EVENT_PASSKEY = BIT(3),
+	/* Pairing finished, successfully or not */
+	APP_EVENT_PAIRING_DONE = BIT(4),
+	/* bt_enable() finished, see ble_central_start() */
+	APP_EVENT_BT_READY = BIT(6),
+	/* Host configured the USB device */
+	APP_EVENT_USB_CONFIGURED = BIT(7),
+	/* Terminal opened on the console (CDC ACM DTR raised) */
+	APP_EVENT_CONSOLE_OPEN = BIT(8),
+};
+
+/**
+ * Post events to the main thread
+ * Safe to call from ISR context
+ * @param events Bitmask of enum app_event
+ */
+void app_event_post(uint32_t events);
+
+/**
+ * Block until at least one event is posted, then consume all pending ones
+ * @return Bitmask of enum app_event
+ */
+uint32_t app_event_wait(void);
+
+#endif /* APP_EVENT_H_ */
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+#include "app_stats.h"
+
+atomic_t app_stats[APP_STAT_COUNT];
+
+static const char *const stat_names[APP_STAT_COUNT] = {
+	[APP_STAT_BLE_CONNECTS] = "connects",
+	[APP_STAT_BLE_DISCONNECTS] = "disconnects",
+	[APP_STAT_BLE_NOTIFICATIONS] = "notifications",
+	[APP_STAT_BLE_ATT_ERRORS] = "ATT errors",
+	[APP_STAT_BLE_PARAM_UPDATES] = "param updates",
+	[APP_STAT_BRIDGE_RECEIVED] = "received",
+	[APP_STAT_BRIDGE_FORWARDED] = "forwarded",
+	[APP_STAT_BRIDGE_SUPPRESSED] = "suppressed",
+	[APP_STAT_BRIDGE_COALESCED] = "coalesced",
+	[APP_STAT_BRIDGE_EVICTED] = "evicted",
+	[APP_STAT_BRIDGE_DROP_USB] = "dropped: USB not ready",
+	[APP_STAT_BRIDGE_DROP_UNSUPPORTED] = "dropped: unsupported",
+	[APP_STAT_BRIDGE_DROP_POOL] = "dropped: pool empty",
+	[APP_STAT_BRIDGE_DROP_QUEUE] = "dropped: queue full",
+	[APP_STAT_BRIDGE_DROP_OTHER] = "dropped: other",
+	[APP_STAT_USB_SENT] = "sent",
+	[APP_STAT_USB_WRITE_ERRORS] = "write errors",
+	[APP_STAT_USB_STALE] = "stale discarded",
+	[APP_STAT_USB_RELEASES] = "key releases",
+	[APP_STAT_USB_SUSPENDS] = "suspends",
+	[APP_STAT_USB_WAKEUPS] = "remote wakeups",
+	[APP_STAT_USB_TIMEOUTS] = "host not polling",
+};
+
+/* First counter of each group */
+static const struct {
+	enum app_stat first;
+	const char *name;
+} groups[] = {
+	{ APP_STAT_BLE_CONNECTS, "BLE" },
+	{ APP_STAT_BRIDGE_RECEIVED, "Bridge" },
+	{ APP_STAT_USB_SENT, "USB" },
+};
+
+void app_stats_print(void)
+{
+	size_t group = 0;
+
+	for (int i = 0; i < APP_STAT_COUNT; i++) {
+		if (group < ARRAY_SIZE(groups) && groups[group].first == i) {
+			printk("\n%s:\n", groups[group].name);
+			group++;
+		}
+
+		printk("  %-24s %10u\n", stat_names[i], app_stats_get(i));
+	}
+
+	printk("\n");
+}
+
+int app_stats_record(uint8_t *buf, size_t size)
+{
+	uint8_t *pos = buf;
+
+	if (size < APP_STATS_RECORD_SIZE) {
+		return -ENOSPC;
+	}
+
+	*pos++ = 'A';
+	*pos++ = 'S';
+	*pos++ = APP_STATS_RECORD_VERSION;
+	*pos++ = APP_STAT_COUNT;
+	sys_put_le32(k_uptime_get_32(), pos);
+	pos += 4;
+
+	for (int i = 0; i < APP_STAT_COUNT; i++) {
+		sys_put_le32(app_stats_get(i), pos);
+		pos += 4;
+	}
+
+	sys_put_le16(crc16_ccitt(0, buf, pos - buf), pos);
+	pos += 2;
+
+	return pos - buf;
+}
@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef APP_STATS_H_
+#define APP_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
+
+/*
+ * Event counters of the BLE, bridge and USB paths, since boot. Each is
+ * an atomic_t, so any thread or ISR may count without a lock. Read as
+ * text ('t') or as a binary record ('T', see app_stats_record()).
+ * Append new counters at the end of their group and bump
+ * APP_STATS_RECORD_VERSION when the order changes.
+ */
+enum app_stat {
+	/* BLE */
+	APP_STAT_BLE_CONNECTS,
+	APP_STAT_BLE_DISCONNECTS,
+	/* Input report notifications received */
+	APP_STAT_BLE_NOTIFICATIONS,
+	/* Failed GATT subscribe, read and write requests */
+	APP_STAT_BLE_ATT_ERRORS,
+	APP_STAT_BLE_PARAM_UPDATES,
+
+	/* Bridge */
+	APP_STAT_BRIDGE_RECEIVED,
+	APP_STAT_BRIDGE_FORWARDED,
+	/* Identical to the previous report of the same ID, not sent */
+	APP_STAT_BRIDGE_SUPPRESSED,
+	/* Merged into a newer report while USB was busy */
+	APP_STAT_BRIDGE_COALESCED,
+	/* Queued, but an older report was evicted to make room */
+	APP_STAT_BRIDGE_EVICTED,
+	/* Dropped: USB not ready */
+	APP_STAT_BRIDGE_DROP_USB,
+	/* Dropped: no route for the report ID and length */
+	APP_STAT_BRIDGE_DROP_UNSUPPORTED,
+	/* Dropped: report pool exhausted */
+	APP_STAT_BRIDGE_DROP_POOL,
+	/* Dropped: report ring or suspend burst full */
+	APP_STAT_BRIDGE_DROP_QUEUE,
+	/* Dropped: rejected by the USB layer for another reason */
+	APP_STAT_BRIDGE_DROP_OTHER,
+
+	/* USB */
+	/* IN transfers completed */
+	APP_STAT_USB_SENT,
+	APP_STAT_USB_WRITE_ERRORS,
+	/* Queued before a key release of their peer, discarded */
+	APP_STAT_USB_STALE,
+	/* Empty reports sent to release keys */
+	APP_STAT_USB_RELEASES,
+	APP_STAT_USB_SUSPENDS,
+	APP_STAT_USB_WAKEUPS,
+	/* IN transfers that outlived the TX timeout: host not polling */
+	APP_STAT_USB_TIMEOUTS,
+
+	APP_STAT_COUNT,
+};
+
+/* Layout version of the binary record */
+#define APP_STATS_RECORD_VERSION 1
+
+/*
+ * Binary record, little-endian:
+ *   'A' 'S' version count   4 bytes
+ *   uptime in ms            4 bytes
+ *   count counter values    4 bytes each, in enum app_stat order
+ *   CRC-16/KERMIT           2 bytes, over everything before it
+ */
+#define APP_STATS_RECORD_SIZE (4 + 4 + 4 * APP_STAT_COUNT + 2)
+
+extern atomic_t app_stats[APP_STAT_COUNT];
+
+/**
+ * Count one event
+ * Safe to call from any context
+ * @param stat Counter
+ */
+static inline void app_stats_inc(enum app_stat stat)
+{
+	atomic_inc(&app_stats[stat]);
+}
+
+/**
+ * Read a counter
+ * @param stat Counter
+ * @return Value since boot
+ */
+static inline uint32_t app_stats_get(enum app_stat stat)
+{
+	return atomic_get(&app_stats[stat]);
+}
+
+/**
+ * Print every counter on the console, grouped by subsystem
+ */
+void app_stats_print(void);
+
+/**
+ * Encode a snapshot of the counters as a binary record
+ * @param buf Destination, at least APP_STATS_RECORD_SIZE bytes
+ * @param size Size of the destination
+ * @return Record length, -ENOSPC if buf is too small
+ */
+int app_stats_record(uint8_t *buf, size_t size);
+
+#endif /* APP_STATS_H_ */
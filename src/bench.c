@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+
+#include "bench.h"
+#include "ble_central.h"
+#include "hid_bridge.h"
+#include "latency.h"
+#include "usb_hid.h"
+#include "console.h"
+
+LOG_MODULE_REGISTER(bench, CONFIG_APP_LOG_LEVEL);
+
+/* Peripheral report ID routed to the USB mouse report (ZMK numbering) */
+#define BENCH_BLE_REPORT_ID 3
+
+/*
+ * Mouse report: buttons byte, 16-bit X and Y, wheel, pan. X alternates
+ * between +1 and -1 so the cursor stays put and no two reports are
+ * equal. A 3-bit sequence number sits in the constant padding bits of
+ * the buttons byte, for the host script to count missing reports.
+ */
+#define BENCH_SEQ_SHIFT 5
+
+static K_SEM_DEFINE(start_sem, 0, 1);
+static struct k_timer tick_timer;
+static atomic_t running;
+static atomic_t stop_requested;
+
+/*
+ * Per-report timestamps. The bench thread fills a sample before it
+ * submits the report and publishes it through sample_count; completions
+ * are matched in order by the generation timestamp, which is unique.
+ */
+struct bench_sample {
+	uint32_t notify_ts;
+	uint32_t gen_us;
+	uint16_t write_us;
+	uint16_t complete_us;
+};
+
+static struct bench_sample samples[MAX(CONFIG_APP_BENCH_SAMPLES, 1)];
+static atomic_t sample_count;
+/* First sample not completed yet, ISR side */
+static uint32_t sample_next;
+static uint32_t run_generated;
+
+static uint16_t sample_time(uint32_t from, uint32_t to)
+{
+	return MIN(latency_cycles_to_us(to - from), BENCH_TIME_NONE - 1);
+}
+
+void bench_report_done(uint32_t notify_ts, uint32_t write_ts,
+		       uint32_t complete_ts)
+{
+	uint32_t count = atomic_get(&sample_count);
+
+	for (uint32_t i = sample_next; i < count; i++) {
+		struct bench_sample *s = &samples[i];
+
+		if (s->notify_ts == notify_ts) {
+			s->write_us = sample_time(notify_ts, write_ts);
+			s->complete_us = sample_time(notify_ts, complete_ts);
+			/* Samples skipped on the way were dropped */
+			sample_next = i + 1;
+			return;
+		}
+	}
+}
+
+int bench_write_samples(bench_write_t write)
+{
+	uint32_t count = atomic_get(&sample_count);
+	uint8_t header[BENCH_RECORD_HEADER_SIZE];
+	uint16_t crc;
+
+	if (atomic_get(&running)) {
+		return -EBUSY;
+	}
+
+	if (count == 0) {
+		return -ENODATA;
+	}
+
+	header[0] = 'B';
+	header[1] = 'S';
+	header[2] = BENCH_RECORD_VERSION;
+	header[3] = 0;
+	sys_put_le32(CONFIG_APP_BENCH_RATE_HZ, &header[4]);
+	sys_put_le32(run_generated, &header[8]);
+	sys_put_le32(count, &header[12]);
+	write(header, sizeof(header));
+	crc = crc16_ccitt(0, header, sizeof(header));
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint8_t sample[BENCH_RECORD_SAMPLE_SIZE];
+
+		sys_put_le32(samples[i].gen_us, &sample[0]);
+		sys_put_le16(samples[i].write_us, &sample[4]);
+		sys_put_le16(samples[i].complete_us, &sample[6]);
+		write(sample, sizeof(sample));
+		crc = crc16_ccitt(crc, sample, sizeof(sample));
+	}
+
+	sys_put_le16(crc, header);
+	write(header, 2);
+
+	return 0;
+}
+
+/* Keep the report's timestamps, until the sample buffer is full */
+static void sample_add(uint32_t index, uint32_t notify_ts, uint64_t elapsed_us)
+{
+	struct bench_sample *s;
+
+	if (index >= CONFIG_APP_BENCH_SAMPLES) {
+		return;
+	}
+
+	s = &samples[index];
+	s->notify_ts = notify_ts;
+	s->gen_us = elapsed_us;
+	s->write_us = BENCH_TIME_NONE;
+	s->complete_us = BENCH_TIME_NONE;
+	atomic_set(&sample_count, index + 1);
+}
+
+static void print_results(uint32_t generated, uint32_t missed,
+			  int64_t elapsed_ms,
+			  const struct hid_bridge_stats *before,
+			  const struct hid_bridge_stats *after)
+{
+	uint32_t forwarded = after->forwarded - before->forwarded;
+	uint32_t dropped = after->dropped - before->dropped;
+	uint32_t suppressed = after->suppressed - before->suppressed;
+
+	elapsed_ms = MAX(elapsed_ms, 1);
+
+	printk("\nBenchmark: %u Hz requested, %lld ms\n",
+	       CONFIG_APP_BENCH_RATE_HZ, elapsed_ms);
+	printk("  Generated: %u (%u timer ticks missed)\n", generated, missed);
+	printk("  Forwarded: %u, %llu reports/s\n", forwarded,
+	       (uint64_t)forwarded * 1000 / elapsed_ms);
+	printk("  Dropped: %u, suppressed: %u, coalesced: %u\n", dropped,
+	       suppressed, app_usb_hid_coalesced_count());
+
+	/* Queueing, endpoint wait and USB completion histograms */
+	latency_print();
+}
+
+static void bench_thread(void *p1, void *p2, void *p3)
+{
+	uint8_t report[APP_USB_HID_MOUSE_SIZE];
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	k_timer_init(&tick_timer, NULL, NULL);
+
+	while (1) {
+		struct hid_bridge_stats before, after;
+		uint32_t generated = 0;
+		uint32_t missed = 0;
+		int64_t start_ms, deadline_ms;
+		/* Counter cycles since the first report, the counter itself
+		 * wraps within a minute at 64 MHz
+		 */
+		uint64_t elapsed = 0;
+		uint32_t last_ts = 0;
+
+		k_sem_take(&start_sem, K_FOREVER);
+
+		atomic_clear(&sample_count);
+		sample_next = 0;
+		latency_reset();
+		hid_bridge_get_stats(&before);
+
+		start_ms = k_uptime_get();
+		deadline_ms = start_ms + CONFIG_APP_BENCH_DURATION_S * MSEC_PER_SEC;
+		k_timer_start(&tick_timer, K_NO_WAIT,
+			      K_USEC(USEC_PER_SEC / CONFIG_APP_BENCH_RATE_HZ));
+
+		while (!atomic_get(&stop_requested) && k_uptime_get() < deadline_ms) {
+			/* Expirations since the last report, more than one
+			 * means the generator fell behind.
+			 */
+			uint32_t ticks = k_timer_status_sync(&tick_timer);
+			uint32_t now;
+
+			if (ticks > 1) {
+				missed += ticks - 1;
+			}
+
+			memset(report, 0, sizeof(report));
+			report[0] = (generated & 0x07) << BENCH_SEQ_SHIFT;
+			sys_put_le16((generated & 1) ? (uint16_t)-1 : 1, &report[1]);
+
+			now = latency_now();
+			if (generated) {
+				elapsed += now - last_ts;
+			}
+			last_ts = now;
+			sample_add(generated, now, latency_cycles_to_us(elapsed));
+
+			hid_bridge_handle_report(0, BENCH_BLE_REPORT_ID, report,
+						 sizeof(report), now);
+			generated++;
+		}
+		run_generated = generated;
+
+		k_timer_stop(&tick_timer);
+
+		/* Let the ring drain before reading the counters */
+		k_sleep(K_MSEC(100));
+		hid_bridge_get_stats(&after);
+
+		print_results(generated, missed, k_uptime_get() - start_ms,
+			      &before, &after);
+
+		atomic_clear(&running);
+		ble_central_start_scan();
+	}
+}
+
+/* Same priority as the Bluetooth RX thread it stands in for */
+K_THREAD_DEFINE(bench_tid, 1024, bench_thread, NULL, NULL, NULL,
+		K_PRIO_COOP(CONFIG_BT_RX_PRIO), 0, 0);
+
+int bench_start(void)
+{
+	if (ble_central_is_connected()) {
+		return -EISCONN;
+	}
+
+	if (!app_usb_hid_ready()) {
+		return -ENOTCONN;
+	}
+
+	if (!atomic_cas(&running, 0, 1)) {
+		return -EBUSY;
+	}
+
+	/* No peripheral may connect and feed reports during the run */
+	ble_central_stop_scan();
+
+	atomic_clear(&stop_requested);
+	LOG_INF("Benchmark: %u reports/s for %u s", CONFIG_APP_BENCH_RATE_HZ,
+		CONFIG_APP_BENCH_DURATION_S);
+	k_sem_give(&start_sem);
+
+	return 0;
+}
+
+void bench_stop(void)
+{
+	atomic_set(&stop_requested, 1);
+}
+
+bool bench_running(void)
+{
+	return atomic_get(&running);
+}
+
+static void cmd_start_stop(void)
+{
+	int ret;
+
+	if (bench_running()) {
+		bench_stop();
+		printk("\nStopping benchmark...\n");
+		return;
+	}
+
+	ret = bench_start();
+	if (ret == -EISCONN) {
+		printk("\nDisconnect the peripherals first.\n\n");
+	} else if (ret) {
+		printk("\nBenchmark not started: %d\n\n", ret);
+	} else {
+		printk("\nBenchmark running, 'b' to stop.\n");
+	}
+}
+
+/* The last run's samples, for scripts/bench_host.py */
+static void cmd_samples(void)
+{
+	int ret = bench_write_samples(console_write_raw);
+
+	if (ret == -EBUSY) {
+		printk("\nBenchmark running, samples not ready.\n\n");
+	} else if (ret) {
+		printk("\nNo benchmark samples: %d\n\n", ret);
+	}
+}
+
+CONSOLE_CMD_DEFINE(cmd_b_bench, "b",
+		   "Start/stop the report benchmark (B: per-report timestamps)",
+		   cmd_start_stop);
+CONSOLE_CMD_DEFINE(cmd_b_bench_samples, "B", NULL, cmd_samples);
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Synthetic report benchmark: a generator thread stands in for the
+ * Bluetooth RX thread and feeds mouse reports through
+ * hid_bridge_handle_report() at CONFIG_APP_BENCH_RATE_HZ. Compiled out
+ * unless CONFIG_APP_BENCH is set; see scripts/bench_host.py for the
+ * host side.
+ *
+ * The first CONFIG_APP_BENCH_SAMPLES reports of a run are timestamped
+ * at generation, endpoint write and IN completion. The host reads them
+ * back ('B') and pairs them with its own arrival times by report index.
+ */
+
+/* Layout version of the sample record */
+#define BENCH_RECORD_VERSION 1
+
+/*
+ * Sample record, little-endian:
+ *   'B' 'S' version 0        4 bytes
+ *   rate in Hz               4 bytes
+ *   reports generated        4 bytes
+ *   sample count             4 bytes
+ *   samples                  8 bytes each, in generation order:
+ *     generation time        4 bytes, us since the first report
+ *     write time             2 bytes, us after generation
+ *     completion time        2 bytes, us after generation
+ *   CRC-16/KERMIT            2 bytes, over everything before it
+ * Write and completion times are BENCH_TIME_NONE if the report never
+ * got there (dropped), and saturate one below it.
+ */
+#define BENCH_RECORD_HEADER_SIZE 16
+#define BENCH_RECORD_SAMPLE_SIZE 8
+#define BENCH_TIME_NONE UINT16_MAX
+
+/**
+ * Callback writing part of the sample record
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+typedef void (*bench_write_t)(const uint8_t *data, size_t len);
+
+#if defined(CONFIG_APP_BENCH)
+
+/**
+ * Start a run of CONFIG_APP_BENCH_DURATION_S seconds
+ * Scanning is stopped for the run, the report path has a single producer.
+ * Results are printed on the console when the run ends.
+ * @return 0 on success, -EBUSY if running, -EISCONN if a peripheral is
+ *         connected, -ENOTCONN if USB is not configured
+ */
+int bench_start(void);
+
+/**
+ * Stop the run early, results are printed as usual
+ */
+void bench_stop(void);
+
+/**
+ * Check if a run is in progress
+ * @return true while generating reports
+ */
+bool bench_running(void);
+
+/**
+ * Timestamp the completion of a report, called by the USB TX path
+ * Reports that are not from the current run are ignored.
+ * Safe to call from ISR context
+ * @param notify_ts Timestamp the report was generated with
+ * @param write_ts Timestamp of the endpoint write
+ * @param complete_ts Timestamp of the IN completion
+ */
+void bench_report_done(uint32_t notify_ts, uint32_t write_ts,
+		       uint32_t complete_ts);
+
+/**
+ * Write the sample record of the last run
+ * @param write Callback receiving the record in pieces
+ * @return 0 on success, -EBUSY while a run is in progress,
+ *         -ENODATA if no run has recorded samples
+ */
+int bench_write_samples(bench_write_t write);
+
+#else
+
+static inline int bench_start(void) { return -ENOTSUP; }
+static inline void bench_stop(void) {}
+static inline bool bench_running(void) { return false; }
+static inline void bench_report_done(uint32_t notify_ts, uint32_t write_ts,
+				     uint32_t complete_ts) {}
+static inline int bench_write_samples(bench_write_t write) { return -ENOTSUP; }
+
+#endif /* CONFIG_APP_BENCH */
+
+#endif /* BENCH_H_ */
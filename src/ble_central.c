@@ -13,15 +13,102 @@
 #include "ble_central.h"
 #include "hogp_client.h"
 #include "pairing.h"
+#include "bond_cache.h"
 #include "hid_bridge.h"
+#include "conn_tuning.h"
+#include "scan_debug.h"
+#include "app_event.h"
+#include "app_stats.h"
+#include "trace.h"
 
-LOG_MODULE_REGISTER(ble_central, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(ble_central, CONFIG_APP_LOG_LEVEL);
 
 /* HID Service UUID */
 static struct bt_uuid_16 hid_uuid = BT_UUID_INIT_16(BT_UUID_HIDS_VAL);
 
-static struct bt_conn *current_conn;
-static bool scanning;
+/*
+ * One slot per peripheral. The slot index is the peer number handed to
+ * the HOGP client, which selects the peer's USB report IDs.
+ */
+static struct bt_conn *conns[CONFIG_APP_MAX_PERIPHERALS];
+
+BUILD_ASSERT(CONFIG_APP_MAX_PERIPHERALS <= CONFIG_BT_MAX_CONN,
+	     "CONFIG_BT_MAX_CONN must allow every peripheral slot");
+
+/* Reconnect policy: what the scanner is currently doing */
+enum scan_phase {
+	SCAN_PHASE_IDLE,
+	/* Direct connection to the most preferred bonded peer */
+	SCAN_PHASE_DIRECT,
+	/* Auto-connect to bonded peers through the accept list, 100% duty */
+	SCAN_PHASE_BURST,
+	/* Low-duty auto-connect through the accept list once the burst is over */
+	SCAN_PHASE_BACKOFF,
+	/* No bonds or pairing window open: UUID scan for a keyboard to pair */
+	SCAN_PHASE_PAIRING,
+};
+
+static enum scan_phase scan_phase;
+/* Set on boot and disconnect, consumed by the next direct attempt / burst */
+static bool direct_pending = true;
+static bool burst_pending = true;
+/* Pending connection of SCAN_PHASE_DIRECT, the slot holds the reference */
+static struct bt_conn *direct_conn;
+static int64_t disconnected_at;
+/* ble_central_pair_new() called, the UUID scan runs despite the bonds */
+static bool pairing_window;
+
+static int slot_find(const struct bt_conn *conn)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(conns); i++) {
+		if (conns[i] == conn) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Take a reference in a free slot, or return the slot already held */
+static int slot_add(struct bt_conn *conn)
+{
+	int slot = slot_find(conn);
+
+	if (slot >= 0) {
+		return slot;
+	}
+
+	slot = slot_find(NULL);
+	if (slot < 0) {
+		return -ENOMEM;
+	}
+
+	conns[slot] = bt_conn_ref(conn);
+	return slot;
+}
+
+static void slot_remove(struct bt_conn *conn)
+{
+	int slot = slot_find(conn);
+
+	if (slot < 0) {
+		return;
+	}
+
+	bt_conn_unref(conns[slot]);
+	conns[slot] = NULL;
+}
+
+static size_t conn_count(void)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(conns); i++) {
+		count += conns[i] != NULL;
+	}
+
+	return count;
+}
 
 /* Buffer to store discovered device name */
 static char discovered_name[32];
@@ -42,12 +129,46 @@ static bool parse_device_name(struct bt_data *data, void *user_data)
 	}
 }
 
-/* BLE connection parameters for low latency */
-static struct bt_le_conn_param conn_param = {
-	.interval_min = 6,   /* 7.5ms (6 * 1.25ms) */
-	.interval_max = 12,  /* 15ms (12 * 1.25ms) */
-	.latency = 0,
-	.timeout = 400,      /* 4s */
+#if defined(CONFIG_APP_FAST_RECONNECT)
+/* Initiator parameters for the direct attempt, only one peer is listened for */
+static const struct bt_conn_le_create_param direct_create_param = {
+	.options = BT_CONN_LE_OPT_NONE,
+	.interval = BT_GAP_SCAN_FAST_INTERVAL,
+	.window = BT_GAP_SCAN_FAST_INTERVAL,
+	.timeout = CONFIG_APP_RECONNECT_DIRECT_MS / 10,
+};
+
+/* Initiator parameters for the reconnect burst: window == interval */
+static const struct bt_conn_le_create_param burst_create_param = {
+	.options = BT_CONN_LE_OPT_NONE,
+	.interval = BT_GAP_SCAN_FAST_INTERVAL,
+	.window = BT_GAP_SCAN_FAST_INTERVAL,
+	.timeout = CONFIG_APP_RECONNECT_BURST_MS / 10,
+};
+
+/*
+ * Low-duty auto-connect after the burst, lets the radio idle. Still only
+ * the bonded peers in the accept list: a stranger is never connected to
+ * outside the pairing scan. Restarted whenever the longest timeout the
+ * initiator takes runs out.
+ */
+static const struct bt_conn_le_create_param backoff_create_param = {
+	.options = BT_CONN_LE_OPT_NONE,
+	.interval = CONFIG_APP_RECONNECT_BACKOFF_INTERVAL,
+	.window = CONFIG_APP_RECONNECT_BACKOFF_WINDOW,
+	.timeout = UINT16_MAX,
+};
+
+static void pairing_window_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(pairing_window_work, pairing_window_handler);
+#endif
+
+/* Regular scan while looking for a keyboard to pair */
+static struct bt_le_scan_param pairing_scan_param = {
+	.type = BT_LE_SCAN_TYPE_ACTIVE,
+	.options = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
+	.interval = BT_GAP_SCAN_FAST_INTERVAL,
+	.window = BT_GAP_SCAN_FAST_WINDOW,
 };
 
 static void scan_filter_match(struct bt_scan_device_info *device_info,
@@ -82,6 +203,10 @@ static void scan_filter_match(struct bt_scan_device_info *device_info,
 static void scan_connecting_error(struct bt_scan_device_info *device_info)
 {
 	LOG_WRN("Connecting failed");
+
+	/* The scan module stopped scanning to connect */
+	scan_phase = SCAN_PHASE_IDLE;
+	ble_central_start_scan();
 }
 
 static void scan_connecting(struct bt_scan_device_info *device_info,
@@ -94,54 +219,16 @@ static void scan_connecting(struct bt_scan_device_info *device_info,
 		LOG_INF("Connecting to device...");
 		printk("Connecting to device...\n");
 	}
-	current_conn = bt_conn_ref(conn);
-}
-
-/* Debug: Show ALL BLE devices (not just filtered ones) */
-static void scan_recv_cb(const struct bt_le_scan_recv_info *info,
-			 struct net_buf_simple *buf)
-{
-	char addr[BT_ADDR_LE_STR_LEN];
-	char name[32] = "(unknown)";
-
-	/* Only show connectable devices */
-	if (!(info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE)) {
-		return;
-	}
-
-	bt_addr_le_to_str(info->addr, addr, sizeof(addr));
-
-	/* Try to extract name from advertising data */
-	struct net_buf_simple_state state;
-	net_buf_simple_save(buf, &state);
 
-	while (buf->len > 1) {
-		uint8_t len = net_buf_simple_pull_u8(buf);
-		if (len == 0 || len > buf->len) {
-			break;
-		}
-		uint8_t type = net_buf_simple_pull_u8(buf);
-		if (type == BT_DATA_NAME_COMPLETE || type == BT_DATA_NAME_SHORTENED) {
-			uint8_t name_len = MIN(len - 1, sizeof(name) - 1);
-			memcpy(name, buf->data, name_len);
-			name[name_len] = '\0';
-			break;
-		}
-		net_buf_simple_pull(buf, len - 1);
-	}
-
-	net_buf_simple_restore(buf, &state);
-
-	/* Only print devices with names (to reduce spam) */
-	if (name[0] != '(' && info->rssi > -80) {
-		printk("[DEBUG] BLE device: \"%s\" [%s] RSSI %d\n", name, addr, info->rssi);
+	/* The scan module stopped scanning to connect */
+	scan_phase = SCAN_PHASE_IDLE;
+	if (slot_add(conn) < 0) {
+		/* Not scanning when all slots are taken, so this is unexpected */
+		LOG_WRN("No free peripheral slot");
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
 	}
 }
 
-static struct bt_le_scan_cb scan_debug_cb = {
-	.recv = scan_recv_cb,
-};
-
 BT_SCAN_CB_INIT(scan_cb, scan_filter_match, NULL,
 		scan_connecting_error, scan_connecting);
 
@@ -151,48 +238,120 @@ static void connected(struct bt_conn *conn, uint8_t err)
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
+	bool burst = scan_phase == SCAN_PHASE_BURST;
+	bool backoff = scan_phase == SCAN_PHASE_BACKOFF;
+	bool direct = scan_phase == SCAN_PHASE_DIRECT && conn == direct_conn;
+	int slot;
+
+	if (burst || backoff || direct) {
+		/* Connection attempt finished, either connected or timed out */
+		scan_phase = SCAN_PHASE_IDLE;
+		direct_conn = NULL;
+	}
+
 	if (err) {
-		LOG_ERR("Failed to connect to %s (err %u)", addr, err);
-		if (current_conn) {
-			bt_conn_unref(current_conn);
-			current_conn = NULL;
+		if (!burst && !backoff && !direct && slot_find(conn) < 0) {
+			/* Cancelled by ble_central_stop_scan(), nothing to restart */
+			return;
+		}
+
+		if (burst && err == BT_HCI_ERR_UNKNOWN_CONN_ID) {
+			LOG_INF("Reconnect burst over, backing off");
+		} else if (backoff && err == BT_HCI_ERR_UNKNOWN_CONN_ID) {
+			LOG_DBG("Low-duty reconnect timed out, restarting");
+		} else if (direct && err == BT_HCI_ERR_UNKNOWN_CONN_ID) {
+			LOG_INF("Preferred bond not in range, trying every bond");
+		} else {
+			LOG_ERR("Failed to connect to %s (err %u)", addr, err);
 		}
+		slot_remove(conn);
 		/* Restart scanning */
 		ble_central_start_scan();
 		return;
 	}
 
-	LOG_INF("Connected: %s", addr);
+	slot = slot_add(conn);
+	if (slot < 0) {
+		LOG_WRN("No free peripheral slot for %s", addr);
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		return;
+	}
 
-	/* Request connection parameter update for low latency */
-	int ret = bt_conn_le_param_update(conn, &conn_param);
-	if (ret) {
-		LOG_WRN("Failed to request connection params update: %d", ret);
+	LOG_INF("Connected: %s (peer %d)", addr, slot);
+	if (!burst && !backoff && !direct) {
+		/* Found by the pairing scan, reconnect policy from here on */
+		pairing_window = false;
 	}
+	app_stats_inc(APP_STAT_BLE_CONNECTS);
+	if (disconnected_at) {
+		LOG_INF("Reconnected %lld ms after disconnect",
+			k_uptime_get() - disconnected_at);
+		disconnected_at = 0;
+	}
+
+	hogp_client_connected(conn, slot);
+
+	/* Connection parameters, PHY and data length: see conn_tuning.c */
 
-	/* Set security level to trigger pairing */
-	ret = bt_conn_set_security(conn, BT_SECURITY_L2);
-	if (ret) {
+	app_event_post(APP_EVENT_CONNECTED);
+
+	/*
+	 * Set security level to trigger pairing. A full bond table only makes
+	 * room once a new bond is stored, see pairing.c; -ENOMEM means even
+	 * the spare key slot is taken.
+	 */
+	int ret = bt_conn_set_security(conn, BT_SECURITY_L2);
+	if (ret == -ENOMEM) {
+		LOG_WRN("No key slot for %s, remove a bond with 'o'", addr);
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		return;
+	} else if (ret) {
 		LOG_ERR("Failed to set security: %d", ret);
 	}
+
+	/* Keep looking for the other peripherals while slots are free */
+	if (conn_count() < CONFIG_APP_MAX_PERIPHERALS) {
+		burst_pending = burst_pending || burst;
+		ble_central_start_scan();
+	}
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
 
+	int slot = slot_find(conn);
+
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 	LOG_INF("Disconnected: %s (reason %u)", addr, reason);
 
-	/* Release all keys on USB to prevent stuck keys */
-	hid_bridge_on_disconnect();
-
-	if (current_conn) {
-		bt_conn_unref(current_conn);
-		current_conn = NULL;
+	if (slot < 0) {
+		return;
 	}
 
-	/* Restart scanning to reconnect */
+	app_stats_inc(APP_STAT_BLE_DISCONNECTS);
+	trace_record(TRACE_EV_DISCONNECT, slot, 0, reason, NULL, 0);
+
+	/* Release this peer's keys on USB to prevent stuck keys */
+	hid_bridge_on_disconnect(slot);
+
+	hogp_client_disconnected(conn);
+	slot_remove(conn);
+
+	app_event_post(APP_EVENT_DISCONNECTED);
+
+	/*
+	 * Restart scanning to reconnect, starting with a burst. A scan
+	 * already running for another peer was set up without this one in
+	 * the accept list, so start over. A running direct attempt or burst
+	 * is left alone, the next burst picks this peer up.
+	 */
+	disconnected_at = k_uptime_get();
+	direct_pending = true;
+	burst_pending = true;
+	if (scan_phase == SCAN_PHASE_BACKOFF || scan_phase == SCAN_PHASE_PAIRING) {
+		ble_central_stop_scan();
+	}
 	ble_central_start_scan();
 }
 
@@ -211,6 +370,9 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 
 	LOG_INF("Security changed: %s level %u", addr, level);
 
+	/* Bonded and encrypted: most recently used from now on */
+	bond_cache_touch(bt_conn_get_dst(conn));
+
 	/* Security established, now discover HOGP service */
 	hogp_client_discover(conn);
 }
@@ -230,25 +392,47 @@ BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.le_param_updated = le_param_updated,
 };
 
+/* Result of bt_enable(), posted to the main thread */
+static int bt_ready_err;
+/* ble_central_start() done, scanning can be started */
+static bool started;
+
+static void bt_ready(int err)
+{
+	bt_ready_err = err;
+	app_event_post(APP_EVENT_BT_READY);
+}
+
 int ble_central_init(void)
 {
 	int err;
 
-	/* Initialize Bluetooth */
-	err = bt_enable(NULL);
+	/* Controller bring-up continues in the background, see bt_ready() */
+	err = bt_enable(bt_ready);
 	if (err) {
 		LOG_ERR("Bluetooth init failed: %d", err);
-		return err;
+	}
+
+	return err;
+}
+
+int ble_central_start(void)
+{
+	int err;
+
+	if (bt_ready_err) {
+		LOG_ERR("Bluetooth init failed: %d", bt_ready_err);
+		return bt_ready_err;
 	}
 
 	LOG_INF("Bluetooth initialized");
 
-	/* Register debug callback to see ALL devices */
-	bt_le_scan_cb_register(&scan_debug_cb);
-	printk("[DEBUG] Debug scan callback registered - will show ALL BLE devices\n");
+	/* Optional diagnostics for every advertiser, see Kconfig */
+	scan_debug_init();
 
-	/* Load stored bonds */
+	/* Load stored bonds, then their reconnect ranking */
 	settings_load();
+	bond_cache_init();
 
 	/* Initialize pairing callbacks */
 	pairing_init();
@@ -256,8 +440,8 @@ int ble_central_init(void)
 	/* Initialize scan module */
 	struct bt_scan_init_param scan_init = {
 		.connect_if_match = 1,
-		.scan_param = NULL, /* Use default params */
-		.conn_param = &conn_param,
+		.scan_param = &pairing_scan_param,
+		.conn_param = conn_tuning_params(),
 	};
 
 	bt_scan_init(&scan_init);
@@ -276,60 +460,249 @@ int ble_central_init(void)
 		return err;
 	}
 
+	started = true;
 	LOG_INF("BLE Central initialized");
 	return 0;
 }
 
-int ble_central_start_scan(void)
+#if defined(CONFIG_APP_FAST_RECONNECT)
+static void accept_list_add(const struct bt_bond_info *info, void *user_data)
 {
+	int *count = user_data;
+	struct bt_conn *conn;
 	int err;
 
-	if (scanning) {
-		return 0;
+	/* Already connected, nothing to reconnect */
+	conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, &info->addr);
+	if (conn) {
+		bt_conn_unref(conn);
+		return;
 	}
 
-	if (current_conn) {
-		LOG_INF("Already connected, not scanning");
+	err = bt_le_filter_accept_list_add(&info->addr);
+	if (err) {
+		LOG_WRN("Failed to add bond to accept list: %d", err);
+		return;
+	}
+
+	(*count)++;
+}
+
+/* Put every bonded peer that is not connected in the controller's accept list */
+static int refresh_accept_list(void)
+{
+	int count = 0;
+
+	bt_le_filter_accept_list_clear();
+	bt_foreach_bond(BT_ID_DEFAULT, accept_list_add, &count);
+
+	return count;
+}
+
+/* Connect straight to the most preferred bonded peer that is not connected */
+static int start_direct(void)
+{
+	struct bond_cache_entry entries[CONFIG_BT_MAX_PAIRED];
+	size_t count = bond_cache_list(entries, ARRAY_SIZE(entries));
+	char addr[BT_ADDR_LE_STR_LEN];
+	struct bt_conn *conn;
+	int err;
+
+	for (size_t i = 0; i < count; i++) {
+		conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, &entries[i].addr);
+		if (conn) {
+			bt_conn_unref(conn);
+			continue;
+		}
+
+		err = bt_conn_le_create(&entries[i].addr, &direct_create_param,
+					conn_tuning_params(), &conn);
+		if (err) {
+			LOG_WRN("Direct connection failed to start: %d", err);
+			return err;
+		}
+
+		/* Free slots are checked before starting, see ble_central_start_scan() */
+		slot_add(conn);
+		bt_conn_unref(conn);
+		direct_conn = conn;
+		scan_phase = SCAN_PHASE_DIRECT;
+
+		bt_addr_le_to_str(&entries[i].addr, addr, sizeof(addr));
+		LOG_INF("Connecting to %s (%u ms)...", addr,
+			CONFIG_APP_RECONNECT_DIRECT_MS);
 		return 0;
 	}
 
+	return -ENOENT;
+}
+
+/* Auto-connect to the peers in the accept list, fast or low duty */
+static int start_auto(const struct bt_conn_le_create_param *param,
+		      enum scan_phase phase)
+{
+	int err;
+
+	err = bt_conn_le_create_auto(param, conn_tuning_params());
+	if (err) {
+		LOG_WRN("Reconnect failed to start: %d", err);
+		return err;
+	}
+
+	scan_phase = phase;
+	if (phase == SCAN_PHASE_BURST) {
+		LOG_INF("Reconnecting to bonded devices (%u ms burst)...",
+			CONFIG_APP_RECONNECT_BURST_MS);
+	} else {
+		LOG_INF("Reconnecting to bonded devices (low duty)...");
+	}
+	return 0;
+}
+
+static void pairing_window_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	if (!pairing_window) {
+		return;
+	}
+
+	LOG_INF("Pairing window closed");
+	pairing_window = false;
+	if (scan_phase == SCAN_PHASE_PAIRING) {
+		ble_central_stop_scan();
+		ble_central_start_scan();
+	}
+}
+#endif /* CONFIG_APP_FAST_RECONNECT */
+
+static int start_uuid_scan(struct bt_le_scan_param *param, enum scan_phase phase)
+{
+	int err;
+
+	bt_scan_params_set(param);
+
 	err = bt_scan_start(BT_SCAN_TYPE_SCAN_ACTIVE);
 	if (err) {
 		LOG_ERR("Scanning failed to start: %d", err);
 		return err;
 	}
 
-	scanning = true;
-	LOG_INF("Scanning for HID devices...");
+	scan_phase = phase;
+	LOG_INF("Scanning for HID devices to pair...");
 	return 0;
 }
 
+int ble_central_start_scan(void)
+{
+	if (!started) {
+		return -EAGAIN;
+	}
+
+	if (scan_phase != SCAN_PHASE_IDLE) {
+		return 0;
+	}
+
+	if (conn_count() >= CONFIG_APP_MAX_PERIPHERALS) {
+		LOG_INF("All peripheral slots in use, not scanning");
+		return 0;
+	}
+
+#if defined(CONFIG_APP_FAST_RECONNECT)
+	if (!pairing_window && refresh_accept_list() > 0) {
+		if (direct_pending) {
+			direct_pending = false;
+			if (start_direct() == 0) {
+				return 0;
+			}
+		}
+
+		if (burst_pending) {
+			burst_pending = false;
+			if (start_auto(&burst_create_param, SCAN_PHASE_BURST) == 0) {
+				return 0;
+			}
+		}
+
+		return start_auto(&backoff_create_param, SCAN_PHASE_BACKOFF);
+	}
+#endif
+
+	return start_uuid_scan(&pairing_scan_param, SCAN_PHASE_PAIRING);
+}
+
 void ble_central_stop_scan(void)
 {
-	if (!scanning) {
+	switch (scan_phase) {
+	case SCAN_PHASE_IDLE:
 		return;
+#if defined(CONFIG_APP_FAST_RECONNECT)
+	case SCAN_PHASE_DIRECT:
+		/* Cancels the pending connection, its slot goes with it */
+		bt_conn_disconnect(direct_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		slot_remove(direct_conn);
+		direct_conn = NULL;
+		break;
+	case SCAN_PHASE_BURST:
+	case SCAN_PHASE_BACKOFF:
+		bt_conn_create_auto_stop();
+		break;
+#endif
+	default:
+		bt_scan_stop();
+		break;
 	}
 
-	bt_scan_stop();
-	scanning = false;
+	scan_phase = SCAN_PHASE_IDLE;
 	LOG_INF("Scanning stopped");
 }
 
+void ble_central_pair_new(void)
+{
+#if defined(CONFIG_APP_FAST_RECONNECT)
+	pairing_window = true;
+	k_work_reschedule(&pairing_window_work,
+			  K_SECONDS(CONFIG_APP_PAIRING_WINDOW_S));
+	LOG_INF("Pairing window open for %u s", CONFIG_APP_PAIRING_WINDOW_S);
+#endif
+
+	if (scan_phase != SCAN_PHASE_PAIRING) {
+		ble_central_stop_scan();
+		ble_central_start_scan();
+	}
+}
+
 struct bt_conn *ble_central_get_conn(void)
 {
-	return current_conn;
+	for (size_t i = 0; i < ARRAY_SIZE(conns); i++) {
+		if (conns[i]) {
+			return conns[i];
+		}
+	}
+
+	return NULL;
+}
+
+size_t ble_central_conn_count(void)
+{
+	return conn_count();
 }
 
 bool ble_central_is_connected(void)
 {
-	return current_conn != NULL;
+	return conn_count() > 0;
 }
 
 int ble_central_disconnect(void)
 {
-	if (!current_conn) {
-		return -ENOTCONN;
+	int ret = -ENOTCONN;
+
+	for (size_t i = 0; i < ARRAY_SIZE(conns); i++) {
+		if (conns[i]) {
+			ret = bt_conn_disconnect(conns[i],
+						 BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		}
 	}
 
-	return bt_conn_disconnect(current_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+	return ret;
 }
@@ -7,14 +7,25 @@
 #include <zephyr/bluetooth/conn.h>
 
 /**
- * Initialize BLE central mode and start scanning for HID devices
+ * Start enabling Bluetooth, returns without waiting for the controller
+ * APP_EVENT_BT_READY is posted once it is up, then call
+ * ble_central_start().
  * @return 0 on success, negative error code on failure
  */
 int ble_central_init(void);
 
+/**
+ * Load the bonds and set up scanning for HID devices
+ * Call once APP_EVENT_BT_READY is posted, from the main thread
+ * @return 0 on success, the bt_enable() error or another negative error
+ *         code on failure
+ */
+int ble_central_start(void);
+
 /**
  * Start scanning for BLE HID devices
- * @return 0 on success, negative error code on failure
+ * @return 0 on success, -EAGAIN before ble_central_start(),
+ *         other negative error code on failure
  */
 int ble_central_start_scan(void);
 
@@ -24,19 +35,33 @@ int ble_central_start_scan(void);
 void ble_central_stop_scan(void);
 
 /**
- * Get the current BLE connection
+ * Scan for a new keyboard to pair
+ * While bonded peers are not connected only they are reconnected to;
+ * this opens a window of CONFIG_APP_PAIRING_WINDOW_S in which the HID
+ * UUID scan runs instead, until a peer is found or the window closes.
+ */
+void ble_central_pair_new(void);
+
+/**
+ * Get the first BLE connection
  * @return Pointer to connection object, or NULL if not connected
  */
 struct bt_conn *ble_central_get_conn(void);
 
+/**
+ * Get the number of connected peripherals
+ * @return Number of connections, at most CONFIG_APP_MAX_PERIPHERALS
+ */
+size_t ble_central_conn_count(void);
+
 /**
  * Check if connected to a HID device
- * @return true if connected, false otherwise
+ * @return true if connected to at least one, false otherwise
  */
 bool ble_central_is_connected(void);
 
 /**
- * Disconnect from current device
+ * Disconnect from every connected device
  * @return 0 on success, negative error code on failure
  */
 int ble_central_disconnect(void);
@@ -0,0 +1,364 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/logging/log.h>
+
+#include "bond_cache.h"
+
+LOG_MODULE_REGISTER(bond_cache, CONFIG_APP_LOG_LEVEL);
+
+#define BOND_CACHE_ROOT "bridge"
+#define BOND_CACHE_LAST BOND_CACHE_ROOT "/last"
+
+/* "bridge/" + 12 hex digits + type + "/" + item name */
+#define KEY_MAX_LEN 32
+
+static const char *const item_names[BOND_CACHE_ITEM_COUNT] = {
+	[BOND_CACHE_REPORT_MAP] = "map",
+	[BOND_CACHE_HOGP] = "hogp",
+	[BOND_CACHE_META] = "meta",
+};
+
+/*
+ * Metadata of every bond, kept in RAM so the reconnect policy can rank
+ * the bonds without reading flash. Changes are written back from the
+ * system workqueue.
+ */
+struct meta_entry {
+	bt_addr_le_t addr;
+	struct bond_cache_meta meta;
+	bool used;
+	bool dirty;
+};
+
+static struct meta_entry metas[CONFIG_BT_MAX_PAIRED];
+static K_MUTEX_DEFINE(metas_lock);
+/* Highest last_used handed out so far */
+static uint32_t last_used_seq;
+
+static void meta_save_handler(struct k_work *work);
+static K_WORK_DEFINE(meta_save_work, meta_save_handler);
+
+struct load_ctx {
+	void *data;
+	size_t len;
+	ssize_t ret;
+};
+
+static void make_key(char *key, const bt_addr_le_t *addr,
+		     enum bond_cache_item item)
+{
+	const uint8_t *a = addr->a.val;
+
+	snprintk(key, KEY_MAX_LEN, BOND_CACHE_ROOT "/%02x%02x%02x%02x%02x%02x%u/%s",
+		 a[5], a[4], a[3], a[2], a[1], a[0], addr->type,
+		 item_names[item]);
+}
+
+static int load_direct_cb(const char *key, size_t len, settings_read_cb read_cb,
+			  void *cb_arg, void *param)
+{
+	struct load_ctx *ctx = param;
+
+	/* Only the exact key, not anything below it */
+	if (key != NULL) {
+		return 0;
+	}
+
+	if (len > ctx->len) {
+		ctx->ret = -ENOSPC;
+		return 0;
+	}
+
+	ctx->ret = read_cb(cb_arg, ctx->data, len);
+	return 0;
+}
+
+static ssize_t load_key(const char *key, void *data, size_t len)
+{
+	struct load_ctx ctx = {
+		.data = data,
+		.len = len,
+		.ret = -ENOENT,
+	};
+	int err;
+
+	err = settings_subsys_init();
+	if (err) {
+		return err;
+	}
+
+	err = settings_load_subtree_direct(key, load_direct_cb, &ctx);
+	if (err) {
+		return err;
+	}
+
+	return ctx.ret;
+}
+
+/* Call with metas_lock held */
+static struct meta_entry *meta_find(const bt_addr_le_t *addr)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(metas); i++) {
+		if (metas[i].used && bt_addr_le_eq(&metas[i].addr, addr)) {
+			return &metas[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* The peer's entry, a new one replaces the least recently used when full */
+static struct meta_entry *meta_get(const bt_addr_le_t *addr)
+{
+	struct meta_entry *entry = meta_find(addr);
+
+	if (entry) {
+		return entry;
+	}
+
+	entry = &metas[0];
+	for (size_t i = 0; i < ARRAY_SIZE(metas); i++) {
+		if (!metas[i].used) {
+			entry = &metas[i];
+			break;
+		}
+
+		if (metas[i].meta.last_used < entry->meta.last_used) {
+			entry = &metas[i];
+		}
+	}
+
+	bt_addr_le_copy(&entry->addr, addr);
+	entry->meta = (struct bond_cache_meta){0};
+	entry->used = true;
+	entry->dirty = false;
+
+	return entry;
+}
+
+static void meta_save_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	for (size_t i = 0; i < ARRAY_SIZE(metas); i++) {
+		struct meta_entry entry;
+
+		k_mutex_lock(&metas_lock, K_FOREVER);
+		entry = metas[i];
+		metas[i].dirty = false;
+		k_mutex_unlock(&metas_lock);
+
+		if (entry.used && entry.dirty) {
+			bond_cache_save(&entry.addr, BOND_CACHE_META, &entry.meta,
+					sizeof(entry.meta));
+		}
+	}
+}
+
+static void meta_load_cb(const struct bt_bond_info *info, void *user_data)
+{
+	struct bond_cache_meta meta = {0};
+	ssize_t len;
+
+	ARG_UNUSED(user_data);
+
+	len = bond_cache_load(&info->addr, BOND_CACHE_META, &meta, sizeof(meta));
+	if (len != sizeof(meta)) {
+		/* Bonded before the index existed, or a different layout */
+		meta = (struct bond_cache_meta){0};
+	}
+
+	k_mutex_lock(&metas_lock, K_FOREVER);
+	meta_get(&info->addr)->meta = meta;
+	last_used_seq = MAX(last_used_seq, meta.last_used);
+	k_mutex_unlock(&metas_lock);
+}
+
+int bond_cache_init(void)
+{
+	bt_foreach_bond(BT_ID_DEFAULT, meta_load_cb, NULL);
+
+	LOG_DBG("Bond index loaded, last connection #%u", last_used_seq);
+	return 0;
+}
+
+void bond_cache_touch(const bt_addr_le_t *addr)
+{
+	struct meta_entry *entry;
+
+	k_mutex_lock(&metas_lock, K_FOREVER);
+	entry = meta_get(addr);
+	entry->meta.last_used = ++last_used_seq;
+	entry->dirty = true;
+	k_mutex_unlock(&metas_lock);
+
+	k_work_submit(&meta_save_work);
+}
+
+int bond_cache_set_priority(const bt_addr_le_t *addr, uint8_t priority)
+{
+	struct meta_entry *entry;
+
+	if (priority > BOND_CACHE_PRIORITY_MAX) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&metas_lock, K_FOREVER);
+	entry = meta_get(addr);
+	entry->meta.priority = priority;
+	entry->dirty = true;
+	k_mutex_unlock(&metas_lock);
+
+	k_work_submit(&meta_save_work);
+	return 0;
+}
+
+/* Ranking of bond_cache_list(): true if a is preferred over b */
+static bool entry_before(const struct bond_cache_entry *a,
+			 const struct bond_cache_entry *b)
+{
+	if (a->meta.priority != b->meta.priority) {
+		return a->meta.priority > b->meta.priority;
+	}
+
+	return a->meta.last_used > b->meta.last_used;
+}
+
+struct list_ctx {
+	struct bond_cache_entry *entries;
+	size_t max;
+	size_t count;
+};
+
+static void list_cb(const struct bt_bond_info *info, void *user_data)
+{
+	struct list_ctx *ctx = user_data;
+	struct bond_cache_entry *entry;
+	struct meta_entry *meta;
+
+	if (ctx->count == ctx->max) {
+		return;
+	}
+
+	entry = &ctx->entries[ctx->count++];
+	bt_addr_le_copy(&entry->addr, &info->addr);
+
+	k_mutex_lock(&metas_lock, K_FOREVER);
+	meta = meta_find(&info->addr);
+	entry->meta = meta ? meta->meta : (struct bond_cache_meta){0};
+	k_mutex_unlock(&metas_lock);
+}
+
+size_t bond_cache_list(struct bond_cache_entry *entries, size_t max)
+{
+	struct list_ctx ctx = {
+		.entries = entries,
+		.max = max,
+	};
+
+	/* The bonds themselves are the source of truth, the index only ranks them */
+	bt_foreach_bond(BT_ID_DEFAULT, list_cb, &ctx);
+
+	/* Insertion sort, there are at most CONFIG_BT_MAX_PAIRED bonds */
+	for (size_t i = 1; i < ctx.count; i++) {
+		struct bond_cache_entry entry = entries[i];
+		size_t j = i;
+
+		while (j > 0 && entry_before(&entry, &entries[j - 1])) {
+			entries[j] = entries[j - 1];
+			j--;
+		}
+
+		entries[j] = entry;
+	}
+
+	return ctx.count;
+}
+
+int bond_cache_save(const bt_addr_le_t *addr, enum bond_cache_item item,
+		    const void *data, size_t len)
+{
+	char key[KEY_MAX_LEN];
+	int err;
+
+	make_key(key, addr, item);
+
+	err = settings_save_one(key, data, len);
+	if (err) {
+		LOG_ERR("Failed to store %s: %d", key, err);
+	} else {
+		LOG_DBG("Stored %s (%zu bytes)", key, len);
+	}
+
+	return err;
+}
+
+ssize_t bond_cache_load(const bt_addr_le_t *addr, enum bond_cache_item item,
+			void *data, size_t len)
+{
+	char key[KEY_MAX_LEN];
+
+	make_key(key, addr, item);
+
+	return load_key(key, data, len);
+}
+
+int bond_cache_delete(const bt_addr_le_t *addr)
+{
+	struct meta_entry *entry;
+	char key[KEY_MAX_LEN];
+	bt_addr_le_t last;
+	int ret = 0;
+
+	for (int i = 0; i < BOND_CACHE_ITEM_COUNT; i++) {
+		int err;
+
+		make_key(key, addr, i);
+		err = settings_delete(key);
+		if (err) {
+			LOG_WRN("Failed to delete %s: %d", key, err);
+			ret = err;
+		}
+	}
+
+	if (bond_cache_get_last(&last) == 0 && bt_addr_le_eq(&last, addr)) {
+		settings_delete(BOND_CACHE_LAST);
+	}
+
+	k_mutex_lock(&metas_lock, K_FOREVER);
+	entry = meta_find(addr);
+	if (entry) {
+		entry->used = false;
+	}
+	k_mutex_unlock(&metas_lock);
+
+	return ret;
+}
+
+int bond_cache_set_last(const bt_addr_le_t *addr)
+{
+	bt_addr_le_t last;
+
+	/* Avoid a flash write on every reconnect to the same peer */
+	if (bond_cache_get_last(&last) == 0 && bt_addr_le_eq(&last, addr)) {
+		return 0;
+	}
+
+	return settings_save_one(BOND_CACHE_LAST, addr, sizeof(*addr));
+}
+
+int bond_cache_get_last(bt_addr_le_t *addr)
+{
+	ssize_t len = load_key(BOND_CACHE_LAST, addr, sizeof(*addr));
+
+	if (len < 0) {
+		return len;
+	}
+
+	return len == sizeof(*addr) ? 0 : -ENOENT;
+}
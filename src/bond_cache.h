@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef BOND_CACHE_H_
+#define BOND_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zephyr/bluetooth/addr.h>
+
+/*
+ * Per-bond cache of data learned from a peripheral, stored in settings
+ * under "bridge/<addr>/<item>" so it survives reboots and reconnects.
+ */
+
+/* Items cached per bond */
+enum bond_cache_item {
+	/* HOGP Report Map (passthrough descriptor) */
+	BOND_CACHE_REPORT_MAP,
+	/* HOGP report handles and Database Hash */
+	BOND_CACHE_HOGP,
+	/* struct bond_cache_meta */
+	BOND_CACHE_META,
+	BOND_CACHE_ITEM_COUNT,
+};
+
+/* Highest user-set bond priority */
+#define BOND_CACHE_PRIORITY_MAX 9
+
+/* Bond metadata, decides the reconnect order and which bond to evict */
+struct bond_cache_meta {
+	/* Connection sequence number, higher is more recent, 0 if never */
+	uint32_t last_used;
+	/* User-set priority, higher is preferred */
+	uint8_t priority;
+};
+
+struct bond_cache_entry {
+	bt_addr_le_t addr;
+	struct bond_cache_meta meta;
+};
+
+/**
+ * Load the metadata of every bond
+ * Call once the bonds are loaded from settings
+ * @return 0 on success, negative error code on failure
+ */
+int bond_cache_init(void);
+
+/**
+ * Store an item for a bonded peer
+ * Writes to flash, do not call from the Bluetooth RX thread
+ * @param addr Peer identity address
+ * @param item Item to store
+ * @param data Item data
+ * @param len Item length
+ * @return 0 on success, negative error code on failure
+ */
+int bond_cache_save(const bt_addr_le_t *addr, enum bond_cache_item item,
+		    const void *data, size_t len);
+
+/**
+ * Load an item for a bonded peer
+ * @param addr Peer identity address
+ * @param item Item to load
+ * @param data Destination buffer
+ * @param len Size of the destination buffer
+ * @return Item length on success, -ENOENT if not cached,
+ *         -ENOSPC if the buffer is too small
+ */
+ssize_t bond_cache_load(const bt_addr_le_t *addr, enum bond_cache_item item,
+			void *data, size_t len);
+
+/**
+ * Remove every cached item of a peer
+ * @param addr Peer identity address
+ * @return 0 on success, negative error code on failure
+ */
+int bond_cache_delete(const bt_addr_le_t *addr);
+
+/**
+ * Record a connection to a bonded peer, for the reconnect order
+ * Safe from the Bluetooth RX thread, the flash write is deferred to the
+ * system workqueue.
+ * @param addr Peer identity address
+ */
+void bond_cache_touch(const bt_addr_le_t *addr);
+
+/**
+ * Set the priority of a bonded peer
+ * @param addr Peer identity address
+ * @param priority 0 (default) to BOND_CACHE_PRIORITY_MAX
+ * @return 0 on success, -EINVAL if the priority is out of range
+ */
+int bond_cache_set_priority(const bt_addr_le_t *addr, uint8_t priority);
+
+/**
+ * List the bonded peers, most preferred first
+ * Ordered by priority, then by most recent connection.
+ * @param entries Destination array
+ * @param max Size of the destination array
+ * @return Number of entries written
+ */
+size_t bond_cache_list(struct bond_cache_entry *entries, size_t max);
+
+/**
+ * Remember the most recently connected peer
+ * @param addr Peer identity address
+ * @return 0 on success, negative error code on failure
+ */
+int bond_cache_set_last(const bt_addr_le_t *addr);
+
+/**
+ * Get the most recently connected peer
+ * @param addr Destination for the peer identity address
+ * @return 0 on success, -ENOENT if no peer was recorded
+ */
+int bond_cache_get_last(bt_addr_le_t *addr);
+
+#endif /* BOND_CACHE_H_ */
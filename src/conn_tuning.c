@@ -0,0 +1,460 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gap.h>
+#include <bluetooth/scan.h>
+#include <zephyr/logging/log.h>
+
+#include "conn_tuning.h"
+#include "latency.h"
+#include "app_stats.h"
+#include "console.h"
+
+LOG_MODULE_REGISTER(conn_tuning, CONFIG_APP_LOG_LEVEL);
+
+/* Delay before asking again for the shortest interval */
+#define PARAM_RETRY_DELAY K_SECONDS(1)
+
+/* Longest supervision timeout, 32 s in 10 ms units */
+#define SUPERVISION_TIMEOUT_MAX 3200
+
+static struct bt_le_conn_param profiles[CONN_PROFILE_COUNT] = {
+	[CONN_PROFILE_GAMING] = {
+		.interval_min = 6,   /* 7.5ms */
+		.interval_max = 6,   /* 7.5ms */
+		.latency = 0,
+		.timeout = 400,      /* 4s */
+	},
+	[CONN_PROFILE_BALANCED] = {
+		.interval_min = 6,   /* 7.5ms */
+		.interval_max = 12,  /* 15ms */
+		.latency = 0,
+		.timeout = 400,      /* 4s */
+	},
+	[CONN_PROFILE_LOW_POWER] = {
+		.interval_min = 12,  /* 15ms */
+		.interval_max = 24,  /* 30ms */
+		.latency = 4,
+		.timeout = 400,      /* 4s */
+	},
+};
+
+static const char *const profile_names[CONN_PROFILE_COUNT] = {
+	[CONN_PROFILE_GAMING] = "gaming",
+	[CONN_PROFILE_BALANCED] = "balanced",
+	[CONN_PROFILE_LOW_POWER] = "low power",
+};
+
+static enum conn_profile active_profile =
+	IS_ENABLED(CONFIG_APP_CONN_PROFILE_GAMING) ? CONN_PROFILE_GAMING :
+	IS_ENABLED(CONFIG_APP_CONN_PROFILE_LOW_POWER) ? CONN_PROFILE_LOW_POWER :
+	CONN_PROFILE_BALANCED;
+
+/* Idle parameters requested, see conn_tuning_set_idle() */
+static bool idle;
+
+/* Negotiated parameters of one connection */
+struct link {
+	struct bt_conn *conn;
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t timeout;
+	uint8_t tx_phy;
+	uint8_t rx_phy;
+	uint16_t tx_len;
+	uint16_t rx_len;
+	uint8_t retries;
+	struct k_work_delayable retry_work;
+};
+
+static struct link links[CONFIG_APP_MAX_PERIPHERALS];
+
+static const char *phy_name(uint8_t phy)
+{
+	switch (phy) {
+	case BT_GAP_LE_PHY_1M:
+		return "1M";
+	case BT_GAP_LE_PHY_2M:
+		return "2M";
+	case BT_GAP_LE_PHY_CODED:
+		return "Coded";
+	default:
+		return "?";
+	}
+}
+
+static struct link *link_get(const struct bt_conn *conn)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		if (links[i].conn == conn) {
+			return &links[i];
+		}
+	}
+
+	return NULL;
+}
+
+static size_t link_count(void)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		count += links[i].conn != NULL;
+	}
+
+	return count;
+}
+
+/*
+ * Parameters to request for the active profile. With several links
+ * the interval is pinned to the profile minimum: links on the same
+ * interval keep a fixed anchor offset, so their connection events never
+ * drift into each other the way a 7.5 ms and a 10 ms link would.
+ */
+static struct bt_le_conn_param wanted_params(void)
+{
+	struct bt_le_conn_param param = profiles[active_profile];
+
+#if defined(CONFIG_APP_IDLE)
+	if (idle) {
+		uint32_t min_timeout;
+
+		if (CONFIG_APP_IDLE_INTERVAL > param.interval_min) {
+			param.interval_min = CONFIG_APP_IDLE_INTERVAL;
+			param.interval_max = CONFIG_APP_IDLE_INTERVAL;
+		}
+		/*
+		 * The supervision timeout must exceed twice the time between
+		 * the events the peripheral attends, and is at most 32 s
+		 */
+		param.latency = MAX(param.latency, CONFIG_APP_IDLE_LATENCY);
+		param.latency = MIN(param.latency,
+				    SUPERVISION_TIMEOUT_MAX * 4 / param.interval_max - 2);
+		/* 1.25 ms intervals, 10 ms timeout units */
+		min_timeout = (1 + param.latency) * param.interval_max / 4 + 1;
+		param.timeout = MIN(MAX(param.timeout, min_timeout),
+				    SUPERVISION_TIMEOUT_MAX);
+	}
+#endif
+
+	if (link_count() > 1) {
+		param.interval_max = param.interval_min;
+	}
+
+	return param;
+}
+
+static void publish_link(const struct link *link)
+{
+	latency_set_link(link->interval, link->latency, link->tx_phy);
+}
+
+static int request_params(struct link *link, const struct bt_le_conn_param *param)
+{
+	int err;
+
+	if (!link->conn) {
+		return -ENOTCONN;
+	}
+
+	err = bt_conn_le_param_update(link->conn, param);
+	if (err) {
+		LOG_WRN("Failed to request connection params update: %d", err);
+	}
+
+	return err;
+}
+
+/* Ask again for the profile's minimum interval only */
+static void retry_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct link *link = CONTAINER_OF(dwork, struct link, retry_work);
+	struct bt_le_conn_param param = wanted_params();
+
+	param.interval_max = param.interval_min;
+
+	LOG_INF("Peer chose %u.%02u ms, asking for %u.%02u ms (retry %u)",
+		link->interval * 125 / 100, link->interval * 125 % 100,
+		param.interval_min * 125 / 100, param.interval_min * 125 % 100,
+		link->retries);
+	request_params(link, &param);
+}
+
+/* Re-apply the profile to every link, e.g. when the link count changes */
+static void request_all(void)
+{
+	struct bt_le_conn_param param = wanted_params();
+
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		if (links[i].conn) {
+			links[i].retries = 0;
+			request_params(&links[i], &param);
+		}
+	}
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	struct bt_conn_info info;
+	struct bt_le_conn_param param;
+	struct link *link;
+	int ret;
+
+	if (err) {
+		return;
+	}
+
+	link = link_get(NULL);
+	if (!link) {
+		return;
+	}
+
+	link->conn = bt_conn_ref(conn);
+	link->retries = 0;
+	link->tx_phy = BT_GAP_LE_PHY_1M;
+	link->rx_phy = BT_GAP_LE_PHY_1M;
+
+	if (bt_conn_get_info(conn, &info) == 0) {
+		link->interval = info.le.interval;
+		link->latency = info.le.latency;
+		link->timeout = info.le.timeout;
+	}
+	publish_link(link);
+
+	/* Request connection parameter update for the active profile */
+	if (link_count() == 2) {
+		/* Second link: pin the first one to the same interval */
+		request_all();
+	} else {
+		param = wanted_params();
+		request_params(link, &param);
+	}
+
+	/* 2M PHY and longer packets where the peer supports them */
+	ret = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (ret) {
+		LOG_DBG("PHY update not requested: %d", ret);
+	}
+
+	ret = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+	if (ret) {
+		LOG_DBG("Data length update not requested: %d", ret);
+	}
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	struct link *link = link_get(conn);
+
+	ARG_UNUSED(reason);
+
+	if (!link) {
+		return;
+	}
+
+	k_work_cancel_delayable(&link->retry_work);
+	bt_conn_unref(link->conn);
+	link->conn = NULL;
+	link->interval = 0;
+	link->latency = 0;
+	link->tx_len = 0;
+	link->rx_len = 0;
+	publish_link(link);
+
+	if (link_count() == 1) {
+		/* Back to a single link: the full profile range is fine again */
+		request_all();
+	}
+}
+
+/* Peer-initiated update: accept it, but within the active profile */
+static bool le_param_req(struct bt_conn *conn, struct bt_le_conn_param *param)
+{
+	struct bt_le_conn_param want = wanted_params();
+
+	ARG_UNUSED(conn);
+
+	LOG_INF("Peer requested interval %u-%u, latency %u, timeout %u",
+		param->interval_min, param->interval_max, param->latency,
+		param->timeout);
+
+	param->interval_min = want.interval_min;
+	param->interval_max = want.interval_max;
+	param->latency = MIN(param->latency, want.latency);
+	param->timeout = MAX(param->timeout, want.timeout);
+
+	return true;
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+			     uint16_t latency, uint16_t timeout)
+{
+	struct bt_le_conn_param want = wanted_params();
+	struct link *link = link_get(conn);
+
+	if (!link) {
+		return;
+	}
+
+	link->interval = interval;
+	link->latency = latency;
+	link->timeout = timeout;
+	publish_link(link);
+	app_stats_inc(APP_STAT_BLE_PARAM_UPDATES);
+
+	if (interval > want.interval_min &&
+	    link->retries < CONFIG_APP_CONN_PARAM_RETRIES) {
+		link->retries++;
+		k_work_reschedule(&link->retry_work, PARAM_RETRY_DELAY);
+	}
+}
+
+static void le_phy_updated(struct bt_conn *conn,
+			   struct bt_conn_le_phy_info *param)
+{
+	struct link *link = link_get(conn);
+
+	if (!link) {
+		return;
+	}
+
+	link->tx_phy = param->tx_phy;
+	link->rx_phy = param->rx_phy;
+	publish_link(link);
+
+	LOG_INF("PHY updated: TX %s, RX %s", phy_name(param->tx_phy),
+		phy_name(param->rx_phy));
+}
+
+static void le_data_len_updated(struct bt_conn *conn,
+				struct bt_conn_le_data_len_info *info)
+{
+	struct link *link = link_get(conn);
+
+	if (!link) {
+		return;
+	}
+
+	link->tx_len = info->tx_max_len;
+	link->rx_len = info->rx_max_len;
+
+	LOG_INF("Data length updated: TX %u, RX %u bytes",
+		info->tx_max_len, info->rx_max_len);
+}
+
+BT_CONN_CB_DEFINE(conn_tuning_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.le_param_req = le_param_req,
+	.le_param_updated = le_param_updated,
+	.le_phy_updated = le_phy_updated,
+	.le_data_len_updated = le_data_len_updated,
+};
+
+static int conn_tuning_init(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		k_work_init_delayable(&links[i].retry_work, retry_handler);
+	}
+
+	return 0;
+}
+
+SYS_INIT(conn_tuning_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+const struct bt_le_conn_param *conn_tuning_params(void)
+{
+	return &profiles[active_profile];
+}
+
+int conn_tuning_set_profile(enum conn_profile profile)
+{
+	if (profile >= CONN_PROFILE_COUNT) {
+		return -EINVAL;
+	}
+
+	active_profile = profile;
+	LOG_INF("Connection profile: %s", profile_names[profile]);
+
+	/* Used by the scanner for the next connection */
+	bt_scan_update_init_conn_params(&profiles[profile]);
+
+	if (link_count() == 0) {
+		return 0;
+	}
+
+	request_all();
+	return 0;
+}
+
+enum conn_profile conn_tuning_get_profile(void)
+{
+	return active_profile;
+}
+
+void conn_tuning_set_idle(bool enable)
+{
+	if (idle == enable) {
+		return;
+	}
+
+	idle = enable;
+	request_all();
+}
+
+const char *conn_tuning_profile_name(enum conn_profile profile)
+{
+	if (profile >= CONN_PROFILE_COUNT) {
+		return "?";
+	}
+
+	return profile_names[profile];
+}
+
+void conn_tuning_print(void)
+{
+	printk("\nConnection profile: %s%s\n", profile_names[active_profile],
+	       idle ? " (idle)" : "");
+
+	if (link_count() == 0) {
+		printk("  Not connected\n\n");
+		return;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		const struct link *link = &links[i];
+		char addr[BT_ADDR_LE_STR_LEN];
+
+		if (!link->conn) {
+			continue;
+		}
+
+		bt_addr_le_to_str(bt_conn_get_dst(link->conn), addr, sizeof(addr));
+		printk("  %s\n", addr);
+		printk("    Interval: %u.%02u ms, latency %u, timeout %u ms\n",
+		       link->interval * 125 / 100, link->interval * 125 % 100,
+		       link->latency, link->timeout * 10);
+		printk("    PHY: TX %s, RX %s\n", phy_name(link->tx_phy),
+		       phy_name(link->rx_phy));
+		printk("    Data length: TX %u, RX %u bytes\n", link->tx_len,
+		       link->rx_len);
+	}
+
+	printk("\n");
+}
+
+static void cmd_next_profile(void)
+{
+	enum conn_profile next = (active_profile + 1) % CONN_PROFILE_COUNT;
+
+	conn_tuning_set_profile(next);
+	printk("\nConnection profile: %s\n\n", profile_names[next]);
+}
+
+CONSOLE_CMD_DEFINE(cmd_p_profile, "pP",
+		   "Cycle connection profile (gaming/balanced/low power)",
+		   cmd_next_profile);
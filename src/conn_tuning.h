@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef CONN_TUNING_H_
+#define CONN_TUNING_H_
+
+#include <zephyr/bluetooth/conn.h>
+
+/* Connection parameter profiles, trading latency against power */
+enum conn_profile {
+	/* 7.5 ms interval, no peripheral latency */
+	CONN_PROFILE_GAMING,
+	/* 7.5-15 ms interval, no peripheral latency */
+	CONN_PROFILE_BALANCED,
+	/* 15-30 ms interval, peripheral latency 4 */
+	CONN_PROFILE_LOW_POWER,
+	CONN_PROFILE_COUNT,
+};
+
+/**
+ * Get the connection parameters of the active profile
+ * Used when creating connections
+ * @return Pointer to connection parameters, valid until the profile changes
+ */
+const struct bt_le_conn_param *conn_tuning_params(void);
+
+/**
+ * Switch profile and apply it to every connection
+ * @param profile Profile to use
+ * @return 0 on success, negative error code on failure
+ */
+int conn_tuning_set_profile(enum conn_profile profile);
+
+/**
+ * Get the active profile
+ * @return Active profile
+ */
+enum conn_profile conn_tuning_get_profile(void);
+
+/**
+ * Switch between idle and the active profile's parameters
+ * Idle asks for CONFIG_APP_IDLE_LATENCY and CONFIG_APP_IDLE_INTERVAL on
+ * top of the profile, applied to every connection.
+ * @param enable true for the idle parameters
+ */
+void conn_tuning_set_idle(bool enable);
+
+/**
+ * Get a printable profile name
+ * @param profile Profile
+ * @return Profile name
+ */
+const char *conn_tuning_profile_name(enum conn_profile profile);
+
+/**
+ * Print the active profile and the negotiated parameters of each link
+ */
+void conn_tuning_print(void);
+
+#endif /* CONN_TUNING_H_ */
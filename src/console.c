@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/atomic.h>
+
+#include "console.h"
+#include "app_event.h"
+
+/* Interval between DTR checks while waiting for a terminal, doubling */
+#define DTR_POLL_MIN_MS 100
+#define DTR_POLL_MAX_MS 3200
+
+static const struct device *console_dev = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
+
+/* Characters received by the UART ISR, drained by the console thread */
+K_MSGQ_DEFINE(console_rx_q, sizeof(uint8_t), 32, 1);
+
+/* Command waiting for its input, NULL when reading keys */
+static const struct console_cmd *pending;
+static char line[CONSOLE_LINE_MAX + 1];
+static size_t line_len;
+
+/* Waiting for a terminal; the checks are paused while the bridge is idle */
+static atomic_t dtr_watching;
+static atomic_t dtr_paused;
+static uint32_t dtr_poll_ms;
+
+static void dtr_poll_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(dtr_poll_work, dtr_poll_handler);
+
+/*
+ * Watch the DTR line of the CDC ACM console: raised when a terminal
+ * opens the port, so the banner goes to someone who can read it. CDC
+ * ACM reports no line state changes, so the line is checked, less and
+ * less often, only until a terminal is seen. A console without line
+ * control counts as always open.
+ */
+static void dtr_poll_handler(struct k_work *work)
+{
+	uint32_t dtr = 0;
+	int err;
+
+	ARG_UNUSED(work);
+
+	if (!atomic_get(&dtr_watching) || atomic_get(&dtr_paused)) {
+		return;
+	}
+
+	err = device_is_ready(console_dev) ?
+	      uart_line_ctrl_get(console_dev, UART_LINE_CTRL_DTR, &dtr) : -ENODEV;
+	if (err || dtr) {
+		/* Open: no more checks until console_watch() */
+		atomic_clear(&dtr_watching);
+		app_event_post(APP_EVENT_CONSOLE_OPEN);
+		return;
+	}
+
+	dtr_poll_ms = CLAMP(dtr_poll_ms * 2, DTR_POLL_MIN_MS, DTR_POLL_MAX_MS);
+	k_work_schedule(&dtr_poll_work, K_MSEC(dtr_poll_ms));
+}
+
+void console_watch(void)
+{
+	dtr_poll_ms = 0;
+	atomic_set(&dtr_watching, 1);
+	k_work_reschedule(&dtr_poll_work, K_NO_WAIT);
+}
+
+void console_set_idle(bool idle)
+{
+	atomic_set(&dtr_paused, idle);
+
+	if (!idle && atomic_get(&dtr_watching)) {
+		k_work_reschedule(&dtr_poll_work, K_NO_WAIT);
+	}
+}
+
+static void console_isr(const struct device *dev, void *user_data)
+{
+	uint8_t buf[16];
+	int len;
+
+	ARG_UNUSED(user_data);
+
+	if (!uart_irq_update(dev)) {
+		return;
+	}
+
+	while (uart_irq_rx_ready(dev)) {
+		len = uart_fifo_read(dev, buf, sizeof(buf));
+		if (len <= 0) {
+			break;
+		}
+
+		/* Drop input the console thread has not caught up with */
+		for (int i = 0; i < len; i++) {
+			k_msgq_put(&console_rx_q, &buf[i], K_NO_WAIT);
+		}
+	}
+}
+
+void console_write_raw(const uint8_t *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		uart_poll_out(console_dev, data[i]);
+	}
+}
+
+void console_print_help(void)
+{
+	printk("Commands:\n");
+
+	STRUCT_SECTION_FOREACH(console_cmd, cmd) {
+		if (cmd->help) {
+			printk("  %c - %s\n", cmd->keys[0], cmd->help);
+		}
+	}
+}
+
+static const struct console_cmd *cmd_find(uint8_t c)
+{
+	if (c == '\0') {
+		return NULL;
+	}
+
+	STRUCT_SECTION_FOREACH(console_cmd, cmd) {
+		if (strchr(cmd->keys, c)) {
+			return cmd;
+		}
+	}
+
+	return NULL;
+}
+
+/* Collect an input line, returns true once it is complete */
+static bool line_input(uint8_t c)
+{
+	if (c == '\r' || c == '\n') {
+		printk("\n");
+		line[line_len] = '\0';
+		line_len = 0;
+		return true;
+	}
+
+	if ((c == '\b' || c == 0x7f) && line_len > 0) {
+		line_len--;
+		printk("\b \b");
+	} else if (c >= ' ' && line_len < CONSOLE_LINE_MAX) {
+		line[line_len++] = c;
+		printk("%c", c);
+	}
+
+	return false;
+}
+
+static void input(uint8_t c)
+{
+	const struct console_cmd *cmd = pending;
+
+	if (cmd) {
+		if (cmd->input == CONSOLE_INPUT_KEY) {
+			line[0] = c;
+			line[1] = '\0';
+		} else if (!line_input(c)) {
+			return;
+		}
+
+		pending = NULL;
+		cmd->done(line);
+		return;
+	}
+
+	cmd = cmd_find(c);
+	if (!cmd) {
+		return;
+	}
+
+	cmd->run();
+	if (cmd->input != CONSOLE_INPUT_NONE) {
+		line_len = 0;
+		pending = cmd;
+	}
+}
+
+static void console_thread(void *p1, void *p2, void *p3)
+{
+	uint8_t c;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (1) {
+		k_msgq_get(&console_rx_q, &c, K_FOREVER);
+		input(c);
+	}
+}
+
+K_THREAD_DEFINE(console_tid, CONFIG_APP_CONSOLE_STACK_SIZE, console_thread,
+		NULL, NULL, NULL, K_PRIO_PREEMPT(CONFIG_APP_CONSOLE_THREAD_PRIO),
+		0, 0);
+
+int console_init(void)
+{
+	int err;
+
+	/* The banner is printed once a terminal is listening */
+	console_watch();
+
+	if (!device_is_ready(console_dev)) {
+		return -ENODEV;
+	}
+
+	err = uart_irq_callback_user_data_set(console_dev, console_isr, NULL);
+	if (err) {
+		return err;
+	}
+
+	uart_irq_rx_enable(console_dev);
+	return 0;
+}
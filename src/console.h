@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef CONSOLE_H_
+#define CONSOLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/sys/iterable_sections.h>
+
+/*
+ * Single-key console commands. Commands are defined with
+ * CONSOLE_CMD_DEFINE() or CONSOLE_CMD_INPUT_DEFINE() in the module they
+ * belong to and collected by the linker (console_cmd.ld). Received
+ * characters are queued by the UART interrupt and dispatched on the
+ * console thread, preemptible at CONFIG_APP_CONSOLE_THREAD_PRIO, so a
+ * command never holds up report forwarding.
+ */
+
+/* What a command reads after its key */
+enum console_input {
+	CONSOLE_INPUT_NONE,
+	/* One more key, e.g. a y/n confirmation */
+	CONSOLE_INPUT_KEY,
+	/* A line, echoed and ended by Enter */
+	CONSOLE_INPUT_LINE,
+};
+
+/* Longest line a CONSOLE_INPUT_LINE command receives */
+#define CONSOLE_LINE_MAX 39
+
+struct console_cmd {
+	/* Keys that run the command, the first one is listed in the help */
+	const char *keys;
+	/* Help text, NULL to leave the command out of the help */
+	const char *help;
+	enum console_input input;
+	/* Run on the key; prompts for the input, if any */
+	void (*run)(void);
+	/* Input read after the key: the line, or the one key as a string */
+	void (*done)(char *input);
+};
+
+/**
+ * Define a command without input
+ * Commands are listed in the help in the order of their names.
+ * @param _name Command name
+ * @param _keys Keys that run it, e.g. "lL"
+ * @param _help Help text, NULL for none
+ * @param _run Handler
+ */
+#define CONSOLE_CMD_DEFINE(_name, _keys, _help, _run)                    \
+	static const STRUCT_SECTION_ITERABLE(console_cmd, _name) = {      \
+		.keys = _keys,                                              \
+		.help = _help,                                              \
+		.input = CONSOLE_INPUT_NONE,                                \
+		.run = _run,                                                \
+	}
+
+/**
+ * Define a command that reads input after its key
+ * @param _name Command name
+ * @param _keys Keys that run it
+ * @param _help Help text, NULL for none
+ * @param _input CONSOLE_INPUT_KEY or CONSOLE_INPUT_LINE
+ * @param _run Handler run on the key, prints the prompt
+ * @param _done Handler receiving the input; an empty line for
+ *              CONSOLE_INPUT_LINE when only Enter was typed
+ */
+#define CONSOLE_CMD_INPUT_DEFINE(_name, _keys, _help, _input, _run, _done) \
+	static const STRUCT_SECTION_ITERABLE(console_cmd, _name) = {        \
+		.keys = _keys,                                                \
+		.help = _help,                                                \
+		.input = _input,                                              \
+		.run = _run,                                                  \
+		.done = _done,                                                \
+	}
+
+/**
+ * Enable console input and start watching for a terminal
+ * Posts APP_EVENT_CONSOLE_OPEN when one opens the port.
+ * @return 0 on success, negative error code if input is unavailable
+ */
+int console_init(void);
+
+/**
+ * Watch for a terminal again, e.g. after USB was configured
+ * Posts APP_EVENT_CONSOLE_OPEN once the DTR line is raised, then stops
+ * checking it.
+ */
+void console_watch(void);
+
+/**
+ * Pause the terminal watch while the bridge is idle
+ * @param idle true to pause, false to resume
+ */
+void console_set_idle(bool idle);
+
+/**
+ * Print the help line of every command
+ */
+void console_print_help(void);
+
+/**
+ * Write raw bytes to the console, for binary records
+ * printk() would stop at the first zero byte.
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+void console_write_raw(const uint8_t *data, size_t len);
+
+#endif /* CONSOLE_H_ */
@@ -1,60 +1,422 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <string.h>
 #include <zephyr/kernel.h>
-#include <zephyr/drivers/gpio.h>
+#include <zephyr/spinlock.h>
 #include <zephyr/logging/log.h>
 
 #include "hid_bridge.h"
+#include "hid_route.h"
+#include "key_state.h"
 #include "usb_hid.h"
+#include "report_pool.h"
 #include "hogp_client.h"
+#include "bond_cache.h"
+#include "status_led.h"
+#include "log_ctl.h"
+#include "app_stats.h"
+#include "trace.h"
+#include "idle.h"
 
-LOG_MODULE_REGISTER(hid_bridge, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(hid_bridge, CONFIG_APP_LOG_LEVEL);
 
-/* LED for status indication - use built-in LED on XIAO */
-static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET_OR(DT_ALIAS(led0), gpios, {0});
+/*
+ * Routes of each BLE report ID, shortest max_len first, indexed once at
+ * init from the linker section (see hid_route.h and hid_routes.c)
+ */
+static const struct hid_route *routes[HID_ROUTE_BLE_ID_COUNT][HID_ROUTES_PER_ID];
 
-/* Statistics */
-static uint32_t reports_received;
-static uint32_t reports_forwarded;
-static uint32_t reports_dropped;
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+/* Report Map handed over by the HOGP client, applied from a work item */
+static struct {
+	struct k_work work;
+	bt_addr_le_t peer;
+	const uint8_t *map;
+	size_t len;
+	bool cached;
+} map_update;
 
-/* Last report for deduplication (optional) */
-static uint8_t last_report[8];
+static void map_update_handler(struct k_work *work)
+{
+	int err;
+
+	ARG_UNUSED(work);
+
+	/* A map that failed to read is not cached, it is read again next time */
+	if (map_update.map && !map_update.cached) {
+		bond_cache_save(&map_update.peer, BOND_CACHE_REPORT_MAP,
+				map_update.map, map_update.len);
+	}
+
+	bond_cache_set_last(&map_update.peer);
+
+	err = app_usb_hid_set_report_map(map_update.map, map_update.len);
+	if (err) {
+		LOG_ERR("Failed to apply peer Report Map: %d", err);
+	}
+}
+
+static void on_report_map(const bt_addr_le_t *peer, const uint8_t *map,
+			  size_t len, bool cached)
+{
+	bt_addr_le_copy(&map_update.peer, peer);
+	map_update.map = map;
+	map_update.len = len;
+	map_update.cached = cached;
+
+	/* Flash writes and USB re-enumeration stay off the BT RX thread */
+	k_work_submit(&map_update.work);
+}
+#endif /* CONFIG_APP_HID_PASSTHROUGH */
+
+/*
+ * Count the result of app_usb_hid_submit() or app_usb_hid_send_report()
+ * @return true if the report was queued
+ */
+static bool count_submit(int err)
+{
+	switch (err) {
+	case 0:
+		return true;
+	case -EOVERFLOW:
+		/* Queued, but an older report was evicted */
+		app_stats_inc(APP_STAT_BRIDGE_EVICTED);
+		return true;
+	case -ENOMEM:
+		app_stats_inc(APP_STAT_BRIDGE_DROP_POOL);
+		return false;
+	case -ENOBUFS:
+		app_stats_inc(APP_STAT_BRIDGE_DROP_QUEUE);
+		break;
+	default:
+		app_stats_inc(APP_STAT_BRIDGE_DROP_OTHER);
+		break;
+	}
+
+	APP_LOG_RATELIMIT(LOG_DBG, "Failed to queue USB report: %d", err);
+	return false;
+}
+
+/* Add a route to the index, keeping each ID's routes sorted by max_len */
+static int route_add(const struct hid_route *route)
+{
+	const struct hid_route **slot;
+	size_t i;
+
+	if (route->ble_id >= HID_ROUTE_BLE_ID_COUNT ||
+	    route->size != app_usb_hid_report_size(route->kind) || !route->fill) {
+		LOG_ERR("Invalid route for BLE report %u", route->ble_id);
+		return -EINVAL;
+	}
+
+	slot = routes[route->ble_id];
+	if (slot[HID_ROUTES_PER_ID - 1]) {
+		LOG_ERR("Too many routes for BLE report %u", route->ble_id);
+		return -ENOSPC;
+	}
+
+	for (i = HID_ROUTES_PER_ID - 1; i > 0; i--) {
+		if (slot[i - 1] && slot[i - 1]->max_len <= route->max_len) {
+			break;
+		}
+		slot[i] = slot[i - 1];
+	}
+	slot[i] = route;
+
+	return 0;
+}
+
+/*
+ * Keyboard state of each peer (Bluetooth RX thread). Keyboard reports
+ * are decoded into it and the USB report is generated from it, in the
+ * format the host can take: 6KRO in Boot Protocol, the peer's own
+ * format otherwise.
+ */
+struct peer_keys {
+	struct key_state state;
+	/* USB report kind holding the state on the host, 0 before any */
+	uint8_t out_kind;
+	/* 6KRO report last sent, keeps the key slots stable */
+	uint8_t boot[APP_USB_HID_KEYBOARD_SIZE];
+};
+
+static struct peer_keys peer_keys[CONFIG_APP_MAX_PERIPHERALS];
+
+/* Route for a BLE report, NULL if unsupported */
+static const struct hid_route *route_find(uint8_t ble_id, uint8_t len)
+{
+	if (ble_id >= HID_ROUTE_BLE_ID_COUNT) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < HID_ROUTES_PER_ID; i++) {
+		const struct hid_route *route = routes[ble_id][i];
+
+		if (!route || len <= route->max_len) {
+			return route;
+		}
+	}
+
+	return NULL;
+}
+
+#if defined(CONFIG_APP_HOST_LEDS)
+/* Output report ID of the keyboard LEDs on the peripheral (ZMK numbering) */
+#define BLE_REPORT_ID_LEDS 1
+/* Longest output report forwarded */
+#define OUTPUT_MAX_LEN 8
+
+/*
+ * Host output reports, latest per peer. The USB stack only stores the
+ * value and queues the work; a burst of LED changes while a write is
+ * pending collapses into one write of the final state.
+ */
+struct output_state {
+	uint8_t ble_id;
+	uint8_t len;
+	uint8_t data[OUTPUT_MAX_LEN];
+};
+
+static struct output_state outputs[CONFIG_APP_MAX_PERIPHERALS];
+/* Last state written per peer, owned by the host_leds work queue */
+static struct output_state outputs_written[CONFIG_APP_MAX_PERIPHERALS];
+/* Peers that disconnected: the work item forgets what it wrote to them */
+static atomic_t outputs_forget;
+static atomic_t outputs_pending;
+/*
+ * Peers to send the current state once they are back and reporting. All
+ * of them at boot: the host sets its LEDs while enumerating, before any
+ * peer is connected.
+ */
+static atomic_t outputs_resync = ATOMIC_INIT(BIT_MASK(CONFIG_APP_MAX_PERIPHERALS));
+static struct k_spinlock outputs_lock;
+
+/* Own low-priority queue: GATT writes never delay input forwarding */
+static K_THREAD_STACK_DEFINE(output_stack, 1024);
+static struct k_work_q output_workq;
+static struct k_work output_work;
+
+static void output_work_handler(struct k_work *work)
+{
+	atomic_val_t pending = atomic_clear(&outputs_pending);
+
+	ARG_UNUSED(work);
+
+	for (uint8_t peer = 0; peer < CONFIG_APP_MAX_PERIPHERALS; peer++) {
+		struct output_state state;
+		k_spinlock_key_t key;
+		int err;
+
+		if (atomic_test_and_clear_bit(&outputs_forget, peer)) {
+			memset(&outputs_written[peer], 0, sizeof(outputs_written[peer]));
+		}
+
+		if (!(pending & BIT(peer))) {
+			continue;
+		}
+
+		key = k_spin_lock(&outputs_lock);
+		state = outputs[peer];
+		k_spin_unlock(&outputs_lock, key);
+
+		if (!memcmp(&state, &outputs_written[peer], sizeof(state))) {
+			continue;
+		}
+
+		err = hogp_client_write_output(peer, state.ble_id, state.data,
+					       state.len);
+		if (err == 0) {
+			outputs_written[peer] = state;
+			LOG_DBG("Peer %u: output report %u written", peer, state.ble_id);
+		} else if (err != -ENOTCONN) {
+			APP_LOG_RATELIMIT(LOG_WRN, "Output report not written: %d", err);
+		}
+	}
+}
+
+/* Called from the USB stack */
+static void on_output_report(uint8_t report_id, const uint8_t *data, uint8_t len)
+{
+	k_spinlock_key_t key;
+	uint8_t peer;
+	uint8_t ble_id;
+
+	if (app_usb_hid_passthrough_active()) {
+		/* The peer's own report IDs */
+		peer = 0;
+		ble_id = report_id;
+	} else {
+		if (report_id == 0 ||
+		    APP_USB_HID_REPORT_KIND(report_id) != APP_USB_HID_REPORT_ID_KEYBOARD) {
+			return;
+		}
+
+		peer = (report_id - 1) / APP_USB_HID_REPORT_ID_COUNT;
+		if (peer >= CONFIG_APP_MAX_PERIPHERALS) {
+			return;
+		}
+		ble_id = BLE_REPORT_ID_LEDS;
+	}
 
-/* Work queue for LED blink on activity */
-static struct k_work_delayable led_off_work;
+	key = k_spin_lock(&outputs_lock);
+	outputs[peer].ble_id = ble_id;
+	outputs[peer].len = MIN(len, OUTPUT_MAX_LEN);
+	memcpy(outputs[peer].data, data, outputs[peer].len);
+	k_spin_unlock(&outputs_lock, key);
 
-static void led_off_handler(struct k_work *work)
+	atomic_or(&outputs_pending, BIT(peer));
+	k_work_submit_to_queue(&output_workq, &output_work);
+}
+
+static void outputs_init(void)
 {
-	if (led.port) {
-		gpio_pin_set_dt(&led, 0);
+	k_work_queue_start(&output_workq, output_stack,
+			   K_THREAD_STACK_SIZEOF(output_stack),
+			   CONFIG_APP_HOST_LEDS_THREAD_PRIO, NULL);
+	k_thread_name_set(&output_workq.thread, "host_leds");
+	k_work_init(&output_work, output_work_handler);
+
+	app_usb_hid_set_output_cb(on_output_report);
+}
+#endif /* CONFIG_APP_HOST_LEDS */
+
+/* Queue the state in one USB keyboard format */
+static int send_keys(uint8_t peer, const struct key_state *state, uint8_t kind,
+		     uint32_t timestamp, uint8_t *boot)
+{
+	struct report_buf *buf;
+
+	buf = report_pool_alloc(APP_USB_HID_REPORT_ID(peer, kind), timestamp);
+	if (!buf) {
+		return -ENOMEM;
+	}
+
+	if (kind == APP_USB_HID_REPORT_ID_NKRO) {
+		key_state_encode_nkro(state, &buf->data[1]);
+		buf->len = 1 + APP_USB_HID_NKRO_SIZE;
+	} else {
+		key_state_encode_6kro(state, boot, &buf->data[1]);
+		buf->len = 1 + APP_USB_HID_KEYBOARD_SIZE;
+		memcpy(boot, &buf->data[1], APP_USB_HID_KEYBOARD_SIZE);
+	}
+
+	return app_usb_hid_submit(buf);
+}
+
+/* Forget a peer's keys, its reports start over from all released */
+static void reset_keys(uint8_t peer)
+{
+	if (peer < CONFIG_APP_MAX_PERIPHERALS) {
+		memset(&peer_keys[peer], 0, sizeof(peer_keys[peer]));
 	}
 }
 
-static void led_blink(void)
+/*
+ * Keyboard report: update the peer's key state and send it if it
+ * changed. The state only advances once the report is queued, so a
+ * dropped report is made up for by the next one.
+ */
+static void handle_keys(uint8_t peer, const struct hid_route *route,
+			const uint8_t *report, uint8_t len, uint32_t timestamp)
 {
-	if (led.port) {
-		gpio_pin_set_dt(&led, 1);
-		k_work_reschedule(&led_off_work, K_MSEC(10));
+	struct peer_keys *keys = &peer_keys[peer];
+	struct key_state next;
+	uint8_t boot[APP_USB_HID_KEYBOARD_SIZE];
+	uint8_t kind;
+	int err;
+
+	if (route->kind == APP_USB_HID_REPORT_ID_NKRO) {
+		key_state_decode_nkro(&next, report, len);
+	} else if (key_state_decode_6kro(&next, report, len)) {
+		/* Keyboard lost track of its keys: keep the last known state */
+		app_stats_inc(APP_STAT_BRIDGE_SUPPRESSED);
+		return;
 	}
+
+	kind = app_usb_hid_boot_protocol() ? APP_USB_HID_REPORT_ID_KEYBOARD :
+	       route->kind;
+
+	if (kind == keys->out_kind && key_state_equal(&next, &keys->state)) {
+		/* Chatter or a replay after reconnect: host already has it */
+		app_stats_inc(APP_STAT_BRIDGE_SUPPRESSED);
+		return;
+	}
+
+	memcpy(boot, keys->boot, sizeof(boot));
+	err = send_keys(peer, &next, kind, timestamp, boot);
+	if (err == -ENOMEM) {
+		APP_LOG_RATELIMIT(LOG_WRN, "Report pool exhausted");
+	}
+	if (!count_submit(err)) {
+		return;
+	}
+
+	if (kind != keys->out_kind && keys->out_kind) {
+		/*
+		 * Format changed (host protocol or the peer's report): empty
+		 * the old report. After the new one, so held keys never
+		 * drop out in between.
+		 */
+		static const struct key_state released;
+		uint8_t old_boot[APP_USB_HID_KEYBOARD_SIZE] = { 0 };
+
+		LOG_DBG("Peer %u: keyboard report kind %u -> %u", peer,
+			keys->out_kind, kind);
+		if (!count_submit(send_keys(peer, &released, keys->out_kind,
+					    timestamp, old_boot))) {
+			/*
+			 * Not queued: release the peer through the path that
+			 * cannot drop. It goes out ahead of the queue and makes
+			 * what is queued stale, the new report included, so that
+			 * one is sent again after it.
+			 */
+			APP_LOG_RATELIMIT(LOG_WRN, "Peer %u: old keyboard report not "
+					  "emptied, releasing the peer", peer);
+			app_usb_hid_release_peer(peer);
+			if (!count_submit(send_keys(peer, &next, kind, timestamp,
+						    boot))) {
+				/* All released on the host, the next report resends */
+				reset_keys(peer);
+				return;
+			}
+		}
+	}
+
+	keys->state = next;
+	keys->out_kind = kind;
+	/* Only the 6KRO report has slots, it is empty in any other format */
+	if (kind == APP_USB_HID_REPORT_ID_KEYBOARD) {
+		memcpy(keys->boot, boot, sizeof(boot));
+	} else {
+		memset(keys->boot, 0, sizeof(keys->boot));
+	}
+
+	app_stats_inc(APP_STAT_BRIDGE_FORWARDED);
+	status_led_activity();
+}
+
+/* Peripheral switched between Boot and Report Protocol */
+static void on_protocol_mode(uint8_t peer, bool boot)
+{
+	LOG_INF("Peer %u: %s protocol, releasing its keys", peer,
+		boot ? "Boot" : "Report");
+
+	/* Its next report starts a new stream */
+	reset_keys(peer);
+	app_usb_hid_release_peer(peer);
 }
 
 int hid_bridge_init(void)
 {
 	int err;
 
-	/* Initialize LED */
-	if (led.port && device_is_ready(led.port)) {
-		err = gpio_pin_configure_dt(&led, GPIO_OUTPUT_INACTIVE);
+	STRUCT_SECTION_FOREACH(hid_route, route) {
+		err = route_add(route);
 		if (err) {
-			LOG_WRN("Failed to configure LED: %d", err);
-		} else {
-			LOG_INF("Status LED configured");
+			return err;
 		}
 	}
 
-	k_work_init_delayable(&led_off_work, led_off_handler);
-
 	/* Initialize HOGP client with our report callback */
 	err = hogp_client_init(hid_bridge_handle_report);
 	if (err) {
@@ -62,74 +424,154 @@ int hid_bridge_init(void)
 		return err;
 	}
 
+	hogp_client_set_pm_cb(on_protocol_mode);
+
+#if defined(CONFIG_APP_HOST_LEDS)
+	outputs_init();
+#endif
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	k_work_init(&map_update.work, map_update_handler);
+	hogp_client_set_map_cb(on_report_map);
+	LOG_INF("Report Map passthrough enabled");
+#endif
+
 	LOG_INF("HID bridge initialized");
 	return 0;
 }
 
-void hid_bridge_handle_report(const uint8_t *report, uint8_t len)
+void hid_bridge_handle_report(uint8_t peer, uint8_t report_id,
+			      const uint8_t *report, uint8_t len,
+			      uint32_t timestamp)
 {
+	const struct hid_route *route;
+	struct report_buf *buf;
+	uint32_t forwarded;
 	int err;
 
-	reports_received++;
-
-	/* Validate report length - boot keyboard is 8 bytes */
-	if (len != 8) {
-		LOG_WRN("Unexpected report length: %u (expected 8)", len);
-		/* Try to handle anyway if it's smaller */
-		if (len > 8) {
-			len = 8;
-		}
-	}
+	app_stats_inc(APP_STAT_BRIDGE_RECEIVED);
+	trace_record(TRACE_EV_NOTIFY, peer, report_id, len, report, len);
+	idle_activity();
 
-	/* Log the report for debugging */
-	LOG_DBG("BLE report: %02x %02x %02x %02x %02x %02x %02x %02x",
-		report[0], len > 1 ? report[1] : 0,
-		len > 2 ? report[2] : 0, len > 3 ? report[3] : 0,
-		len > 4 ? report[4] : 0, len > 5 ? report[5] : 0,
-		len > 6 ? report[6] : 0, len > 7 ? report[7] : 0);
+	/* Log the report for debugging, 'k' has the recent ones cheaply */
+	LOG_HEXDUMP_DBG(report, len, "BLE report");
 
 	/* Check if USB is ready */
 	if (!app_usb_hid_ready()) {
-		reports_dropped++;
-		if (reports_dropped % 100 == 1) {
-			LOG_WRN("USB not ready, reports dropped: %u", reports_dropped);
+		app_stats_inc(APP_STAT_BRIDGE_DROP_USB);
+		APP_LOG_RATELIMIT(LOG_WRN, "USB not ready, reports dropped: %u",
+				  app_stats_get(APP_STAT_BRIDGE_DROP_USB));
+		return;
+	}
+
+	if (app_usb_hid_passthrough_active()) {
+		/* Host has the peer's own descriptor: copy straight through */
+		err = app_usb_hid_send_report(report_id, report, len, timestamp);
+		if (err == -ENOMEM) {
+			APP_LOG_RATELIMIT(LOG_WRN, "Report pool exhausted");
+		}
+		if (!count_submit(err)) {
+			return;
 		}
+
+		app_stats_inc(APP_STAT_BRIDGE_FORWARDED);
+		status_led_activity();
 		return;
 	}
 
-	/* Forward to USB with proper 8-byte buffer */
-	uint8_t usb_report[8] = {0};
-	memcpy(usb_report, report, len < 8 ? len : 8);
+	route = route_find(report_id, len);
+	if (!route || peer >= CONFIG_APP_MAX_PERIPHERALS) {
+		app_stats_inc(APP_STAT_BRIDGE_DROP_UNSUPPORTED);
+		APP_LOG_RATELIMIT(LOG_DBG, "Unsupported report id=%u len=%u",
+				  report_id, len);
+		return;
+	}
 
-	err = app_usb_hid_send_report(usb_report);
-	if (err) {
-		reports_dropped++;
-		LOG_DBG("Failed to send USB report: %d", err);
+#if defined(CONFIG_APP_HOST_LEDS)
+	/* First report after a reconnect: subscribed, time to restore the LEDs */
+	if (unlikely(atomic_test_and_clear_bit(&outputs_resync, peer))) {
+		atomic_or(&outputs_pending, BIT(peer));
+		k_work_submit_to_queue(&output_workq, &output_work);
+	}
+#endif
+
+	if (route->kind == APP_USB_HID_REPORT_ID_KEYBOARD ||
+	    route->kind == APP_USB_HID_REPORT_ID_NKRO) {
+		handle_keys(peer, route, report, len, timestamp);
 		return;
 	}
 
-	reports_forwarded++;
+	/*
+	 * The only copy of the report: out of the notification straight into
+	 * a pool buffer, filled by the route at the native size of the USB
+	 * report. Each peripheral has its own set of USB report IDs. The
+	 * buffer is passed by reference from here to the IN endpoint.
+	 */
+	buf = report_pool_alloc(APP_USB_HID_REPORT_ID(peer, route->kind), timestamp);
+	if (!buf) {
+		app_stats_inc(APP_STAT_BRIDGE_DROP_POOL);
+		APP_LOG_RATELIMIT(LOG_WRN, "Report pool exhausted");
+		return;
+	}
 
-	/* Blink LED on activity */
-	led_blink();
+	route->fill(route, buf, report, len);
 
-	/* Store for potential deduplication */
-	memcpy(last_report, usb_report, 8);
+	if (app_usb_hid_is_duplicate(buf)) {
+		/* Chatter or a replay after reconnect: host already has it */
+		report_pool_unref(buf);
+		app_stats_inc(APP_STAT_BRIDGE_SUPPRESSED);
+		return;
+	}
 
-	/* Periodic stats logging */
-	if (reports_forwarded % 1000 == 0) {
-		LOG_INF("Stats: received=%u, forwarded=%u, dropped=%u",
-			reports_received, reports_forwarded, reports_dropped);
+	/* Queue for the USB TX thread, never blocks the BT RX thread */
+	if (!count_submit(app_usb_hid_submit(buf))) {
+		return;
+	}
+
+	forwarded = atomic_inc(&app_stats[APP_STAT_BRIDGE_FORWARDED]) + 1;
+
+	/* Flicker the LED on the next tick */
+	status_led_activity();
+
+	/* Periodic stats logging, 't' shows everything */
+	if (forwarded % 1000 == 0) {
+		LOG_DBG("Stats: forwarded=%u, pool free=%u", forwarded,
+			report_pool_free_count());
 	}
 }
 
-void hid_bridge_on_disconnect(void)
+void hid_bridge_on_disconnect(uint8_t peer)
 {
-	LOG_INF("BLE disconnected, releasing all keys");
+	LOG_INF("Peer %u disconnected, releasing its keys", peer);
+
+	reset_keys(peer);
+
+#if defined(CONFIG_APP_HOST_LEDS)
+	/*
+	 * Whatever connects next has not seen the LED state yet. The work
+	 * item clears what it wrote itself, a write still in flight would
+	 * otherwise put the old state back.
+	 */
+	if (peer < CONFIG_APP_MAX_PERIPHERALS) {
+		atomic_set_bit(&outputs_forget, peer);
+		atomic_or(&outputs_resync, BIT(peer));
+	}
+#endif
 
-	/* Release all keys to prevent stuck keys */
-	app_usb_hid_release_all();
+	/*
+	 * Release all keys to prevent stuck keys. Returns at once, the USB
+	 * TX thread sends the empty reports ahead of anything still queued.
+	 */
+	app_usb_hid_release_peer(peer);
+}
 
-	/* Clear last report */
-	memset(last_report, 0, sizeof(last_report));
+void hid_bridge_get_stats(struct hid_bridge_stats *stats)
+{
+	stats->received = app_stats_get(APP_STAT_BRIDGE_RECEIVED);
+	stats->forwarded = app_stats_get(APP_STAT_BRIDGE_FORWARDED);
+	stats->dropped = app_stats_get(APP_STAT_BRIDGE_EVICTED);
+	for (int i = APP_STAT_BRIDGE_DROP_USB; i <= APP_STAT_BRIDGE_DROP_OTHER; i++) {
+		stats->dropped += app_stats_get(i);
+	}
+	stats->suppressed = app_stats_get(APP_STAT_BRIDGE_SUPPRESSED);
 }
@@ -14,16 +14,38 @@ int hid_bridge_init(void);
 
 /**
  * Handle incoming BLE HID report and forward to USB
- * Called from HOGP client when a report is received
- * @param report Pointer to report data (8 bytes for boot keyboard)
+ * Called from HOGP client when a report is received, routes it by
+ * report ID onto the matching USB report of that peripheral
+ * @param peer Peripheral index
+ * @param report_id Report ID assigned by the peripheral
+ * @param report Pointer to report data
  * @param len Length of report data
+ * @param timestamp Timestamp taken on notification arrival (latency_now())
  */
-void hid_bridge_handle_report(const uint8_t *report, uint8_t len);
+void hid_bridge_handle_report(uint8_t peer, uint8_t report_id,
+			      const uint8_t *report, uint8_t len,
+			      uint32_t timestamp);
+
+/* Report counters since boot */
+struct hid_bridge_stats {
+	uint32_t received;
+	uint32_t forwarded;
+	uint32_t dropped;
+	/* Identical to the previous report of the same ID, not sent */
+	uint32_t suppressed;
+};
+
+/**
+ * Get the report counters
+ * @param stats Destination for the counters
+ */
+void hid_bridge_get_stats(struct hid_bridge_stats *stats);
 
 /**
- * Handle BLE disconnection
- * Releases all keys on USB to prevent stuck keys
+ * Handle BLE disconnection of one peripheral
+ * Releases all of its keys on USB to prevent stuck keys
+ * @param peer Peripheral index
  */
-void hid_bridge_on_disconnect(void);
+void hid_bridge_on_disconnect(uint8_t peer);
 
 #endif /* HID_BRIDGE_H_ */
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef HID_ROUTE_H_
+#define HID_ROUTE_H_
+
+#include <stdint.h>
+#include <zephyr/sys/iterable_sections.h>
+
+/*
+ * Routes from BLE input reports to USB reports, one per report type.
+ * Routes are defined with HID_ROUTE_DEFINE() anywhere in the application
+ * and collected by the linker (hid_route.ld). hid_bridge.c indexes them
+ * by BLE report ID at boot. A report ID may have several routes told
+ * apart by length, e.g. boot keyboard and NKRO on ID 1.
+ */
+
+/* BLE report IDs a route can be defined for, 0 to this minus one */
+#define HID_ROUTE_BLE_ID_COUNT 8
+/* Routes sharing one BLE report ID */
+#define HID_ROUTES_PER_ID 2
+
+struct report_buf;
+struct hid_route;
+
+/**
+ * Fill a pool buffer from a BLE report
+ * Called on the Bluetooth RX thread, the buffer already holds the USB
+ * report ID in data[0].
+ * @param route Route the report matched
+ * @param buf Buffer to fill: data[1] onwards and len
+ * @param report BLE report body
+ * @param len BLE report length, at most route->max_len
+ */
+typedef void (*hid_route_fill_t)(const struct hid_route *route,
+				 struct report_buf *buf,
+				 const uint8_t *report, uint8_t len);
+
+struct hid_route {
+	/* Report ID from the peripheral's Report Reference */
+	uint8_t ble_id;
+	/* Longest BLE report taken by this route */
+	uint8_t max_len;
+	/* USB report kind (APP_USB_HID_REPORT_ID_KEYBOARD...) */
+	uint8_t kind;
+	/* USB report body size, app_usb_hid_report_size() of the kind */
+	uint8_t size;
+	hid_route_fill_t fill;
+};
+
+/**
+ * Define a route
+ * @param _name Route name
+ * @param _ble_id BLE report ID, below HID_ROUTE_BLE_ID_COUNT
+ * @param _max_len Longest BLE report taken, UINT8_MAX for any
+ * @param _kind USB report kind
+ * @param _size USB report body size
+ * @param _fill hid_route_fill_t, hid_route_copy() for a straight copy
+ */
+#define HID_ROUTE_DEFINE(_name, _ble_id, _max_len, _kind, _size, _fill) \
+	static const STRUCT_SECTION_ITERABLE(hid_route, _name) = {       \
+		.ble_id = _ble_id,                                        \
+		.max_len = _max_len,                                      \
+		.kind = _kind,                                            \
+		.size = _size,                                            \
+		.fill = _fill,                                            \
+	}
+
+/**
+ * Copy the BLE report into the buffer, truncated or zero-padded to the
+ * USB report size. See hid_route_fill_t.
+ */
+void hid_route_copy(const struct hid_route *route, struct report_buf *buf,
+		    const uint8_t *report, uint8_t len);
+
+#endif /* HID_ROUTE_H_ */
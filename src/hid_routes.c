@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "hid_route.h"
+#include "report_pool.h"
+#include "usb_hid.h"
+
+/*
+ * Report IDs used by the peripheral (ZMK numbering). A keyboard report
+ * larger than the boot layout carries an NKRO bitmap.
+ */
+#define BLE_REPORT_ID_NONE     0
+#define BLE_REPORT_ID_KEYBOARD 1
+#define BLE_REPORT_ID_CONSUMER 2
+#define BLE_REPORT_ID_MOUSE    3
+
+void hid_route_copy(const struct hid_route *route, struct report_buf *buf,
+		    const uint8_t *report, uint8_t len)
+{
+	memcpy(&buf->data[1], report, MIN(len, route->size));
+	if (len < route->size) {
+		memset(&buf->data[1 + len], 0, route->size - len);
+	}
+	buf->len = route->size + 1;
+}
+
+/*
+ * Keyboard and NKRO routes pick the decoder only: the bridge keeps the
+ * peer's key state and generates the USB report from it.
+ * Keyboard without a Report Reference is treated as report ID 1.
+ */
+HID_ROUTE_DEFINE(route_keyboard_noid, BLE_REPORT_ID_NONE,
+		 APP_USB_HID_KEYBOARD_SIZE, APP_USB_HID_REPORT_ID_KEYBOARD,
+		 APP_USB_HID_KEYBOARD_SIZE, hid_route_copy);
+HID_ROUTE_DEFINE(route_nkro_noid, BLE_REPORT_ID_NONE, UINT8_MAX,
+		 APP_USB_HID_REPORT_ID_NKRO, APP_USB_HID_NKRO_SIZE,
+		 hid_route_copy);
+
+HID_ROUTE_DEFINE(route_keyboard, BLE_REPORT_ID_KEYBOARD,
+		 APP_USB_HID_KEYBOARD_SIZE, APP_USB_HID_REPORT_ID_KEYBOARD,
+		 APP_USB_HID_KEYBOARD_SIZE, hid_route_copy);
+HID_ROUTE_DEFINE(route_nkro, BLE_REPORT_ID_KEYBOARD, UINT8_MAX,
+		 APP_USB_HID_REPORT_ID_NKRO, APP_USB_HID_NKRO_SIZE,
+		 hid_route_copy);
+
+HID_ROUTE_DEFINE(route_consumer, BLE_REPORT_ID_CONSUMER, UINT8_MAX,
+		 APP_USB_HID_REPORT_ID_CONSUMER, APP_USB_HID_CONSUMER_SIZE,
+		 hid_route_copy);
+
+HID_ROUTE_DEFINE(route_mouse, BLE_REPORT_ID_MOUSE, UINT8_MAX,
+		 APP_USB_HID_REPORT_ID_MOUSE, APP_USB_HID_MOUSE_SIZE,
+		 hid_route_copy);
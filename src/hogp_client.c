@@ -1,30 +1,437 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/att.h>
+#include <zephyr/bluetooth/uuid.h>
 #include <bluetooth/gatt_dm.h>
 #include <bluetooth/services/hogp.h>
 #include <bluetooth/services/hids.h>
 #include <zephyr/logging/log.h>
 
 #include "hogp_client.h"
+#include "latency.h"
+#include "bond_cache.h"
+#include "app_event.h"
+#include "app_stats.h"
 
-LOG_MODULE_REGISTER(hogp_client, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(hogp_client, CONFIG_APP_LOG_LEVEL);
 
-static struct bt_hogp hogp;
 static hogp_report_cb_t report_callback;
-static bool hogp_ready;
-static uint8_t subscribed_reports;
+static hogp_pm_cb_t pm_callback;
+
+/* Bump when struct hogp_cache changes layout */
+#define HOGP_CACHE_VERSION 1
+
+/* Database Hash characteristic value size */
+#define DB_HASH_SIZE 16
+
+/* Everything needed to subscribe without discovery, stored per bond */
+struct hogp_cache_report {
+	uint16_t value_handle;
+	uint16_t ccc_handle;
+	uint8_t id;
+	uint8_t type;
+};
+
+struct hogp_cache {
+	uint8_t version;
+	uint8_t has_db_hash;
+	uint8_t db_hash[DB_HASH_SIZE];
+	uint8_t count;
+	struct hogp_cache_report reports[CONFIG_APP_HOGP_MAX_REPORTS];
+};
+
+/* Time from connection to subscription and to the first report */
+enum connect_path {
+	PATH_CACHED,
+	PATH_COLD,
+	PATH_COUNT,
+};
+
+/* State of one connected peripheral */
+struct hogp_peer {
+	struct bt_conn *conn;
+	struct bt_hogp hogp;
+	bool hogp_ready;
+	uint8_t subscribed_reports;
+	/* Reports of the connection, from discovery or the cache */
+	struct hogp_cache report_table;
+	struct bt_gatt_subscribe_params sub_params[CONFIG_APP_HOGP_MAX_REPORTS];
+	bool using_cache;
+	/* Waiting for another peer's GATT discovery to finish */
+	bool discovery_pending;
+	struct bt_gatt_read_params db_hash_params;
+	struct k_work cache_save_work;
+	/* Bumped per connection; the save only applies to the one it was for */
+	atomic_t conn_gen;
+	atomic_val_t cache_save_gen;
+	bt_addr_le_t cache_save_addr;
+	int64_t connected_at;
+	bool first_report_seen;
+	/* Protocol Mode last reported, Report Protocol after connecting */
+	bool boot_protocol;
+};
+
+static struct hogp_peer peers[CONFIG_APP_MAX_PERIPHERALS];
+
+/* Reconnect timing over all peers */
+static struct {
+	uint32_t count[PATH_COUNT];
+	uint32_t ready_ms[PATH_COUNT];
+	uint32_t first_report_ms[PATH_COUNT];
+} timing;
+
+static void start_discovery(struct hogp_peer *peer);
+static void unsubscribe_reports(struct hogp_peer *peer);
+
+static uint8_t peer_index(const struct hogp_peer *peer)
+{
+	return peer - peers;
+}
+
+static struct hogp_peer *peer_get(const struct bt_conn *conn)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].conn == conn) {
+			return &peers[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void record_ready(struct hogp_peer *peer)
+{
+	enum connect_path path = peer->using_cache ? PATH_CACHED : PATH_COLD;
+
+	timing.ready_ms[path] = k_uptime_get() - peer->connected_at;
+	timing.count[path]++;
+	LOG_INF("Peer %u: reports subscribed %u ms after connect (%s)",
+		peer_index(peer), timing.ready_ms[path],
+		peer->using_cache ? "cached" : "cold");
+
+	app_event_post(APP_EVENT_HID_READY);
+}
+
+static void record_first_report(struct hogp_peer *peer)
+{
+	enum connect_path path = peer->using_cache ? PATH_CACHED : PATH_COLD;
+
+	peer->first_report_seen = true;
+	timing.first_report_ms[path] = k_uptime_get() - peer->connected_at;
+}
+
+static void cache_save_handler(struct k_work *work)
+{
+	struct hogp_peer *peer = CONTAINER_OF(work, struct hogp_peer,
+					      cache_save_work);
+
+	if (!peer->conn || atomic_get(&peer->conn_gen) != peer->cache_save_gen) {
+		/* Disconnected, or the slot went to another connection */
+		return;
+	}
+
+	bond_cache_save(&peer->cache_save_addr, BOND_CACHE_HOGP,
+			&peer->report_table, sizeof(peer->report_table));
+	LOG_INF("Peer %u: HOGP handles cached (%u reports)", peer_index(peer),
+		peer->report_table.count);
+}
+
+static uint8_t db_hash_read_cb(struct bt_conn *conn, uint8_t err,
+			       struct bt_gatt_read_params *params,
+			       const void *data, uint16_t length)
+{
+	struct hogp_peer *peer = CONTAINER_OF(params, struct hogp_peer,
+					      db_hash_params);
+	struct hogp_cache *table = &peer->report_table;
+	bool found = !err && data && length == DB_HASH_SIZE;
+
+	ARG_UNUSED(conn);
+
+	if (err && err != BT_ATT_ERR_ATTRIBUTE_NOT_FOUND) {
+		app_stats_inc(APP_STAT_BLE_ATT_ERRORS);
+	}
+
+	if (peer->using_cache) {
+		/* Validate the cache entry we subscribed with */
+		if (table->has_db_hash &&
+		    (!found || memcmp(data, table->db_hash, DB_HASH_SIZE))) {
+			LOG_WRN("Peer database changed, rediscovering");
+			unsubscribe_reports(peer);
+			start_discovery(peer);
+		} else {
+			LOG_DBG("HOGP cache valid");
+		}
+		return BT_GATT_ITER_STOP;
+	}
+
+	/* Cold path: store the hash with the freshly discovered handles */
+	table->has_db_hash = found;
+	if (found) {
+		memcpy(table->db_hash, data, DB_HASH_SIZE);
+	}
+
+	if (IS_ENABLED(CONFIG_APP_HOGP_CACHE)) {
+		peer->cache_save_gen = atomic_get(&peer->conn_gen);
+		bt_addr_le_copy(&peer->cache_save_addr, bt_conn_get_dst(peer->conn));
+		k_work_submit(&peer->cache_save_work);
+	}
+
+	return BT_GATT_ITER_STOP;
+}
+
+static void db_hash_read(struct hogp_peer *peer)
+{
+	struct bt_gatt_read_params *params = &peer->db_hash_params;
+	int err;
+
+	memset(params, 0, sizeof(*params));
+	params->func = db_hash_read_cb;
+	params->handle_count = 0;
+	params->by_uuid.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	params->by_uuid.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	params->by_uuid.uuid = BT_UUID_GATT_DB_HASH;
+
+	err = bt_gatt_read(peer->conn, params);
+	if (err) {
+		LOG_WRN("Failed to read Database Hash: %d", err);
+		db_hash_read_cb(peer->conn, BT_ATT_ERR_UNLIKELY, params, NULL, 0);
+	}
+}
+
+/* Load handles cached for this bond, true if they can be used */
+static bool cache_load(struct hogp_peer *peer)
+{
+	struct hogp_cache *table = &peer->report_table;
+	ssize_t len;
+
+	if (!IS_ENABLED(CONFIG_APP_HOGP_CACHE)) {
+		return false;
+	}
+
+	len = bond_cache_load(bt_conn_get_dst(peer->conn), BOND_CACHE_HOGP,
+			      table, sizeof(*table));
+	if (len != sizeof(*table) ||
+	    table->version != HOGP_CACHE_VERSION ||
+	    table->count == 0) {
+		memset(table, 0, sizeof(*table));
+		return false;
+	}
+
+	return true;
+}
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+static hogp_map_cb_t map_callback;
+static uint8_t report_map[CONFIG_APP_HID_PASSTHROUGH_MAP_MAX_SIZE];
+static size_t report_map_len;
+static bool report_map_known;
+/* GATT read in progress, and whether it already failed */
+static bool report_map_reading;
+static bool report_map_error;
+
+/* End of a GATT read: hand over the map, or NULL for the default descriptor */
+static void report_map_done(struct bt_hogp *hogp_ctx)
+{
+	const bt_addr_le_t *peer = bt_conn_get_dst(bt_hogp_conn(hogp_ctx));
+
+	if (!report_map_reading) {
+		return;
+	}
+	report_map_reading = false;
+
+	if (report_map_error || report_map_len == 0) {
+		/* Neither applied nor cached, the next connection reads again */
+		LOG_WRN("No Report Map, using the default descriptor");
+		report_map_len = 0;
+		map_callback(peer, NULL, 0, false);
+		return;
+	}
+
+	LOG_INF("Report Map read (%zu bytes)", report_map_len);
+	report_map_known = true;
+	map_callback(peer, report_map, report_map_len, false);
+}
+
+/* Report Map read callback, called per chunk and once with data == NULL */
+static void hogp_map_read_cb(struct bt_hogp *hogp_ctx, uint8_t err,
+			     const uint8_t *data, size_t size, size_t offset)
+{
+	if (err) {
+		app_stats_inc(APP_STAT_BLE_ATT_ERRORS);
+		LOG_ERR("Report Map read error: %u", err);
+		report_map_error = true;
+		report_map_done(hogp_ctx);
+		return;
+	}
+
+	if (!data) {
+		report_map_done(hogp_ctx);
+		return;
+	}
+
+	if (report_map_error) {
+		return;
+	}
+
+	if (offset + size > sizeof(report_map)) {
+		LOG_ERR("Report Map too large (> %zu bytes)", sizeof(report_map));
+		report_map_error = true;
+		return;
+	}
+
+	memcpy(&report_map[offset], data, size);
+	report_map_len = offset + size;
+}
+
+/* Serve the Report Map from the bond cache without waiting for GATT */
+static void report_map_from_cache(struct bt_conn *conn)
+{
+	const bt_addr_le_t *peer = bt_conn_get_dst(conn);
+	ssize_t len;
+
+	report_map_known = false;
+	report_map_reading = false;
+	report_map_len = 0;
+
+	if (!map_callback) {
+		return;
+	}
+
+	len = bond_cache_load(peer, BOND_CACHE_REPORT_MAP, report_map,
+			      sizeof(report_map));
+	if (len <= 0) {
+		return;
+	}
+
+	LOG_INF("Report Map from bond cache (%zd bytes)", len);
+	report_map_len = len;
+	report_map_known = true;
+	map_callback(peer, report_map, report_map_len, true);
+}
+
+static bool report_map_cached(void)
+{
+	return !map_callback || report_map_known;
+}
+
+/* Read the Report Map over GATT if the bond cache did not have it */
+static void report_map_read(struct bt_hogp *hogp_ctx)
+{
+	int err;
+
+	if (!map_callback || report_map_known) {
+		return;
+	}
+
+	report_map_len = 0;
+	report_map_error = false;
+	report_map_reading = true;
+
+	err = bt_hogp_map_read(hogp_ctx, hogp_map_read_cb, 0, K_NO_WAIT);
+	if (err) {
+		LOG_ERR("Failed to read Report Map: %d", err);
+		report_map_error = true;
+		report_map_done(hogp_ctx);
+	}
+}
+#endif /* CONFIG_APP_HID_PASSTHROUGH */
 
 /* Input report notification handler */
-static uint8_t hogp_report_notify(struct bt_hogp *hogp_ctx,
-				  struct bt_hogp_rep_info *rep,
-				  uint8_t err,
-				  const uint8_t *data)
+static uint8_t hogp_report_notify(struct bt_conn *conn,
+				  struct bt_gatt_subscribe_params *params,
+				  const void *data, uint16_t length)
+{
+	uint32_t timestamp = latency_now();
+	struct hogp_peer *peer = peer_get(conn);
+	size_t idx;
+
+	if (!data) {
+		LOG_DBG("Report unsubscribed (handle 0x%04x)", params->value_handle);
+		params->value_handle = 0;
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (!peer) {
+		return BT_GATT_ITER_STOP;
+	}
+
+	app_stats_inc(APP_STAT_BLE_NOTIFICATIONS);
+
+	if (unlikely(!peer->first_report_seen)) {
+		record_first_report(peer);
+	}
+
+	/* Forward to registered callback */
+	idx = params - peer->sub_params;
+	if (report_callback && idx < peer->report_table.count) {
+		report_callback(peer_index(peer), peer->report_table.reports[idx].id,
+				data, MIN(length, UINT8_MAX), timestamp);
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+/* Subscribe to every input report of the peer's report table */
+static int subscribe_reports(struct hogp_peer *peer)
+{
+	const struct hogp_cache *table = &peer->report_table;
+	int err;
+
+	peer->subscribed_reports = 0;
+
+	for (uint8_t i = 0; i < table->count; i++) {
+		const struct hogp_cache_report *rep = &table->reports[i];
+		struct bt_gatt_subscribe_params *params = &peer->sub_params[i];
+
+		if (rep->type != BT_HIDS_REPORT_TYPE_INPUT || rep->ccc_handle == 0) {
+			continue;
+		}
+
+		memset(params, 0, sizeof(*params));
+		params->notify = hogp_report_notify;
+		params->value = BT_GATT_CCC_NOTIFY;
+		params->value_handle = rep->value_handle;
+		params->ccc_handle = rep->ccc_handle;
+		/* Re-subscribed on every connection, don't keep across bonds */
+		atomic_set_bit(params->flags, BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
+
+		err = bt_gatt_subscribe(peer->conn, params);
+		if (err && err != -EALREADY) {
+			app_stats_inc(APP_STAT_BLE_ATT_ERRORS);
+			LOG_ERR("Failed to subscribe to report %u: %d", rep->id, err);
+			continue;
+		}
+
+		LOG_DBG("Subscribed to input report %u", rep->id);
+		peer->subscribed_reports++;
+	}
+
+	if (peer->subscribed_reports == 0) {
+		LOG_ERR("No input reports found to subscribe");
+		return -ENOENT;
+	}
+
+	LOG_INF("Subscribed to %u input reports", peer->subscribed_reports);
+	peer->hogp_ready = true;
+	record_ready(peer);
+	return 0;
+}
+
+/* Input report notification from bt_hogp, see subscribe_hogp_reports() */
+static uint8_t hogp_rep_notify(struct bt_hogp *hogp_ctx,
+			       struct bt_hogp_rep_info *rep, uint8_t err,
+			       const uint8_t *data)
 {
+	uint32_t timestamp = latency_now();
+	struct hogp_peer *peer = CONTAINER_OF(hogp_ctx, struct hogp_peer, hogp);
+
 	if (err) {
+		app_stats_inc(APP_STAT_BLE_ATT_ERRORS);
 		LOG_ERR("Report notification error: %u", err);
 		return BT_GATT_ITER_STOP;
 	}
@@ -34,65 +441,170 @@ static uint8_t hogp_report_notify(struct bt_hogp *hogp_ctx,
 		return BT_GATT_ITER_STOP;
 	}
 
-	uint8_t id = bt_hogp_rep_id(rep);
-	size_t len = bt_hogp_rep_size(rep);
+	app_stats_inc(APP_STAT_BLE_NOTIFICATIONS);
 
-	LOG_DBG("Report received: id=%u, len=%zu", id, len);
+	if (unlikely(!peer->first_report_seen)) {
+		record_first_report(peer);
+	}
 
-	/* Forward to registered callback */
 	if (report_callback) {
-		report_callback(data, len);
+		report_callback(peer_index(peer), bt_hogp_rep_id(rep), data,
+				MIN(bt_hogp_rep_size(rep), UINT8_MAX), timestamp);
 	}
 
 	return BT_GATT_ITER_CONTINUE;
 }
 
-/* HOGP ready callback */
-static void hogp_ready_cb(struct bt_hogp *hogp_ctx)
+/*
+ * Subscribe through bt_hogp's own report list, for when the discovered
+ * handles cannot be matched to it. Nothing is cached: the next
+ * connection discovers again.
+ */
+static int subscribe_hogp_reports(struct hogp_peer *peer)
 {
-	int err;
 	struct bt_hogp_rep_info *rep = NULL;
-	size_t rep_count;
+	int err;
 
-	LOG_INF("HOGP service ready");
+	peer->subscribed_reports = 0;
 
-	rep_count = bt_hogp_rep_count(hogp_ctx);
-	LOG_INF("Found %zu HID reports", rep_count);
+	while ((rep = bt_hogp_rep_next(&peer->hogp, rep)) != NULL) {
+		uint8_t id = bt_hogp_rep_id(rep);
+
+		LOG_INF("Report: id=%u, type=%u", id, bt_hogp_rep_type(rep));
+
+		if (bt_hogp_rep_type(rep) != BT_HIDS_REPORT_TYPE_INPUT) {
+			continue;
+		}
+
+		err = bt_hogp_rep_subscribe(&peer->hogp, rep, hogp_rep_notify);
+		if (err) {
+			app_stats_inc(APP_STAT_BLE_ATT_ERRORS);
+			LOG_ERR("Failed to subscribe to report %u: %d", id, err);
+			continue;
+		}
+
+		LOG_DBG("Subscribed to input report %u", id);
+		peer->subscribed_reports++;
+	}
+
+	if (peer->subscribed_reports == 0) {
+		LOG_ERR("No input reports found to subscribe");
+		return -ENOENT;
+	}
+
+	LOG_INF("Subscribed to %u input reports (not cached)",
+		peer->subscribed_reports);
+	peer->hogp_ready = true;
+	record_ready(peer);
+	return 0;
+}
+
+static void unsubscribe_reports(struct hogp_peer *peer)
+{
+	for (uint8_t i = 0; i < peer->report_table.count; i++) {
+		if (peer->sub_params[i].value_handle) {
+			bt_gatt_unsubscribe(peer->conn, &peer->sub_params[i]);
+		}
+	}
+
+	peer->subscribed_reports = 0;
+	peer->hogp_ready = false;
+}
+
+/*
+ * Collect value and CCC handles of every Report characteristic.
+ * bt_hogp builds its report list in the same characteristic order, so
+ * report IDs and types are filled in from it once HOGP is ready.
+ */
+static void collect_report_handles(struct hogp_peer *peer,
+				   struct bt_gatt_dm *dm)
+{
+	struct hogp_cache *table = &peer->report_table;
+	const struct bt_gatt_dm_attr *attr = NULL;
 
-	subscribed_reports = 0;
+	memset(table, 0, sizeof(*table));
+	table->version = HOGP_CACHE_VERSION;
 
-	/* Iterate through all reports and subscribe to input reports */
-	while ((rep = bt_hogp_rep_next(hogp_ctx, rep)) != NULL) {
-		uint8_t rep_id = bt_hogp_rep_id(rep);
-		enum bt_hids_report_type rep_type = bt_hogp_rep_type(rep);
+	while ((attr = bt_gatt_dm_char_next(dm, attr)) != NULL) {
+		const struct bt_gatt_chrc *chrc = bt_gatt_dm_attr_chrc_val(attr);
+		const struct bt_gatt_dm_attr *ccc;
+		struct hogp_cache_report *rep;
 
-		LOG_INF("Report: id=%u, type=%u", rep_id, rep_type);
+		if (bt_uuid_cmp(chrc->uuid, BT_UUID_HIDS_REPORT)) {
+			continue;
+		}
 
-		/* Subscribe to input reports only */
-		if (rep_type == BT_HIDS_REPORT_TYPE_INPUT) {
-			err = bt_hogp_rep_subscribe(hogp_ctx, rep, hogp_report_notify);
-			if (err) {
-				LOG_ERR("Failed to subscribe to report %u: %d", rep_id, err);
-			} else {
-				LOG_INF("Subscribed to input report %u", rep_id);
-				subscribed_reports++;
-			}
+		if (table->count >= ARRAY_SIZE(table->reports)) {
+			LOG_WRN("More than %u reports, extra ones ignored",
+				table->count);
+			break;
 		}
+
+		rep = &table->reports[table->count++];
+		rep->value_handle = chrc->value_handle;
+		ccc = bt_gatt_dm_desc_by_uuid(dm, attr, BT_UUID_GATT_CCC);
+		rep->ccc_handle = ccc ? ccc->handle : 0;
 	}
+}
+
+/* HOGP ready callback (cold path) */
+static void hogp_ready_cb(struct bt_hogp *hogp_ctx)
+{
+	struct hogp_peer *peer = CONTAINER_OF(hogp_ctx, struct hogp_peer, hogp);
+	struct hogp_cache *table = &peer->report_table;
+	struct bt_hogp_rep_info *rep = NULL;
+	size_t rep_count;
+	uint8_t i = 0;
+
+	LOG_INF("Peer %u: HOGP service ready", peer_index(peer));
 
-	if (subscribed_reports > 0) {
-		LOG_INF("Subscribed to %u input reports", subscribed_reports);
-		hogp_ready = true;
+	rep_count = bt_hogp_rep_count(hogp_ctx);
+	LOG_INF("Found %zu HID reports", rep_count);
+
+	if (rep_count != table->count) {
+		/* E.g. more reports than CONFIG_APP_HOGP_MAX_REPORTS */
+		LOG_WRN("HOGP reports (%zu) do not match discovered handles (%u)",
+			rep_count, table->count);
+		subscribe_hogp_reports(peer);
 	} else {
-		LOG_ERR("No input reports found to subscribe");
+		/* Fill in report IDs and types, in characteristic order */
+		while ((rep = bt_hogp_rep_next(hogp_ctx, rep)) != NULL &&
+		       i < table->count) {
+			table->reports[i].id = bt_hogp_rep_id(rep);
+			table->reports[i].type = bt_hogp_rep_type(rep);
+
+			LOG_INF("Report: id=%u, type=%u", table->reports[i].id,
+				table->reports[i].type);
+			i++;
+		}
+
+		if (subscribe_reports(peer) == 0) {
+			/* Database Hash completes the cache entry */
+			db_hash_read(peer);
+		}
 	}
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	report_map_read(hogp_ctx);
+#endif
 }
 
 /* HOGP protocol mode change callback */
 static void hogp_pm_update_cb(struct bt_hogp *hogp_ctx)
 {
-	uint8_t pm = bt_hogp_pm_get(hogp_ctx);
-	LOG_INF("Protocol mode: %s", pm == BT_HIDS_PM_BOOT ? "Boot" : "Report");
+	struct hogp_peer *peer = CONTAINER_OF(hogp_ctx, struct hogp_peer, hogp);
+	bool boot = bt_hogp_pm_get(hogp_ctx) == BT_HIDS_PM_BOOT;
+
+	LOG_INF("Protocol mode: %s", boot ? "Boot" : "Report");
+
+	if (boot == peer->boot_protocol) {
+		return;
+	}
+
+	peer->boot_protocol = boot;
+	if (pm_callback) {
+		pm_callback(peer_index(peer), boot);
+	}
 }
 
 static struct bt_hogp_init_params hogp_init_params = {
@@ -100,18 +612,31 @@ static struct bt_hogp_init_params hogp_init_params = {
 	.pm_update_cb = hogp_pm_update_cb,
 };
 
+/* Only one GATT discovery runs at a time: start the next waiting one */
+static void discovery_next(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].conn && peers[i].discovery_pending) {
+			start_discovery(&peers[i]);
+			return;
+		}
+	}
+}
+
 /* GATT Discovery completed callback */
 static void discovery_completed(struct bt_gatt_dm *dm, void *ctx)
 {
+	struct hogp_peer *peer = ctx;
 	int err;
 
-	ARG_UNUSED(ctx);
-	LOG_INF("GATT discovery completed");
+	LOG_INF("Peer %u: GATT discovery completed", peer_index(peer));
 
 	bt_gatt_dm_data_print(dm);
 
+	collect_report_handles(peer, dm);
+
 	/* Initialize HOGP with discovered services */
-	err = bt_hogp_handles_assign(dm, &hogp);
+	err = bt_hogp_handles_assign(dm, &peer->hogp);
 	if (err) {
 		LOG_ERR("Failed to assign HOGP handles: %d", err);
 		goto release;
@@ -127,18 +652,22 @@ release:
 	if (err) {
 		LOG_ERR("Failed to release discovery data: %d", err);
 	}
+
+	discovery_next();
 }
 
 /* GATT Discovery service not found callback */
 static void discovery_service_not_found(struct bt_conn *conn, void *ctx)
 {
 	LOG_ERR("HID service not found");
+	discovery_next();
 }
 
 /* GATT Discovery error callback */
 static void discovery_error_found(struct bt_conn *conn, int err, void *ctx)
 {
 	LOG_ERR("GATT discovery error: %d", err);
+	discovery_next();
 }
 
 static struct bt_gatt_dm_cb discovery_cb = {
@@ -150,31 +679,215 @@ static struct bt_gatt_dm_cb discovery_cb = {
 int hogp_client_init(hogp_report_cb_t cb)
 {
 	report_callback = cb;
-	hogp_ready = false;
 
-	bt_hogp_init(&hogp, &hogp_init_params);
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		bt_hogp_init(&peers[i].hogp, &hogp_init_params);
+		k_work_init(&peers[i].cache_save_work, cache_save_handler);
+	}
 
-	LOG_INF("HOGP client initialized");
+	LOG_INF("HOGP client initialized (%u peers)", CONFIG_APP_MAX_PERIPHERALS);
 	return 0;
 }
 
-int hogp_client_discover(struct bt_conn *conn)
+int hogp_client_connected(struct bt_conn *conn, uint8_t peer_id)
+{
+	struct hogp_peer *peer;
+
+	if (peer_id >= ARRAY_SIZE(peers)) {
+		return -EINVAL;
+	}
+
+	peer = &peers[peer_id];
+	atomic_inc(&peer->conn_gen);
+	peer->conn = conn;
+	peer->hogp_ready = false;
+	peer->discovery_pending = false;
+	peer->connected_at = k_uptime_get();
+	peer->first_report_seen = false;
+	peer->boot_protocol = false;
+	return 0;
+}
+
+void hogp_client_disconnected(struct bt_conn *conn)
+{
+	struct hogp_peer *peer = peer_get(conn);
+
+	if (!peer) {
+		return;
+	}
+
+	peer->hogp_ready = false;
+	peer->subscribed_reports = 0;
+	peer->discovery_pending = false;
+	atomic_inc(&peer->conn_gen);
+	peer->conn = NULL;
+
+	/* Volatile subscriptions are dropped by the stack on disconnect */
+	if (bt_hogp_assign_check(&peer->hogp)) {
+		bt_hogp_release(&peer->hogp);
+	}
+}
+
+static void start_discovery(struct hogp_peer *peer)
 {
 	int err;
 
-	LOG_INF("Starting HOGP discovery...");
-	hogp_ready = false;
+	peer->using_cache = false;
+
+	if (bt_hogp_assign_check(&peer->hogp)) {
+		bt_hogp_release(&peer->hogp);
+	}
 
-	err = bt_gatt_dm_start(conn, BT_UUID_HIDS, &discovery_cb, NULL);
+	err = bt_gatt_dm_start(peer->conn, BT_UUID_HIDS, &discovery_cb, peer);
+	if (err == -EALREADY) {
+		/* Another peer is being discovered, run after it */
+		LOG_INF("Peer %u: discovery queued", peer_index(peer));
+		peer->discovery_pending = true;
+		return;
+	}
+
+	peer->discovery_pending = false;
 	if (err) {
 		LOG_ERR("Failed to start GATT discovery: %d", err);
-		return err;
 	}
+}
 
+int hogp_client_discover(struct bt_conn *conn)
+{
+	struct hogp_peer *peer = peer_get(conn);
+
+	if (!peer) {
+		return -ENOENT;
+	}
+
+	peer->hogp_ready = false;
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	/* Re-enumerate with the cached map while HOGP is being set up */
+	report_map_from_cache(conn);
+#endif
+
+	bool use_cache = cache_load(peer);
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	/* Passthrough needs bt_hogp to read a map that is not cached yet */
+	use_cache = use_cache && report_map_cached();
+#endif
+
+	if (use_cache) {
+		LOG_INF("Using cached HOGP handles (%u reports)",
+			peer->report_table.count);
+		peer->using_cache = true;
+
+		if (subscribe_reports(peer) == 0) {
+			/* Validate in the background, reports already flow */
+			db_hash_read(peer);
+			return 0;
+		}
+	}
+
+	LOG_INF("Starting HOGP discovery...");
+	start_discovery(peer);
 	return 0;
 }
 
+/* Output report to write for report_id, NULL if there is none */
+static const struct hogp_cache_report *output_report_find(const struct hogp_cache *table,
+							   uint8_t report_id)
+{
+	const struct hogp_cache_report *found = NULL;
+	uint8_t outputs = 0;
+
+	for (uint8_t i = 0; i < table->count; i++) {
+		const struct hogp_cache_report *rep = &table->reports[i];
+
+		if (rep->type != BT_HIDS_REPORT_TYPE_OUTPUT) {
+			continue;
+		}
+
+		if (rep->id == report_id) {
+			return rep;
+		}
+
+		found = rep;
+		outputs++;
+	}
+
+	return outputs == 1 ? found : NULL;
+}
+
+int hogp_client_write_output(uint8_t peer_id, uint8_t report_id,
+			     const uint8_t *data, uint8_t len)
+{
+	const struct hogp_cache_report *rep;
+	struct hogp_peer *peer;
+	struct bt_conn *conn;
+	int err;
+
+	if (peer_id >= ARRAY_SIZE(peers)) {
+		return -EINVAL;
+	}
+
+	peer = &peers[peer_id];
+	conn = peer->conn;
+	if (!conn || !peer->hogp_ready) {
+		return -ENOTCONN;
+	}
+
+	rep = output_report_find(&peer->report_table, report_id);
+	if (!rep) {
+		return -ENOENT;
+	}
+
+	/* Held across the write in case the peer disconnects meanwhile */
+	conn = bt_conn_ref(conn);
+	err = bt_gatt_write_without_response(conn, rep->value_handle, data, len,
+					     false);
+	bt_conn_unref(conn);
+
+	if (err) {
+		app_stats_inc(APP_STAT_BLE_ATT_ERRORS);
+	}
+
+	return err;
+}
+
+void hogp_client_print_timing(void)
+{
+	static const char *const names[PATH_COUNT] = {
+		[PATH_CACHED] = "cached",
+		[PATH_COLD] = "cold",
+	};
+
+	printk("\nReconnect (ms)     count    ready  first report\n");
+	for (int i = 0; i < PATH_COUNT; i++) {
+		printk("  %-14s %8u %8u %13u\n", names[i], timing.count[i],
+		       timing.ready_ms[i], timing.first_report_ms[i]);
+	}
+	printk("\n");
+}
+
 bool hogp_client_ready(void)
 {
-	return hogp_ready;
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].hogp_ready) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void hogp_client_set_pm_cb(hogp_pm_cb_t cb)
+{
+	pm_callback = cb;
+}
+
+void hogp_client_set_map_cb(hogp_map_cb_t cb)
+{
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	map_callback = cb;
+#else
+	ARG_UNUSED(cb);
+#endif
 }
@@ -7,10 +7,34 @@
 
 /**
  * Callback type for receiving HID input reports
+ * @param peer Peripheral index, as given to hogp_client_connected()
+ * @param report_id Report ID from the peripheral's Report Reference
  * @param report Pointer to report data
  * @param len Length of report data
+ * @param timestamp Timestamp taken on notification arrival (latency_now())
  */
-typedef void (*hogp_report_cb_t)(const uint8_t *report, uint8_t len);
+typedef void (*hogp_report_cb_t)(uint8_t peer, uint8_t report_id,
+				 const uint8_t *report, uint8_t len,
+				 uint32_t timestamp);
+
+/**
+ * Callback type for receiving the peripheral's Report Map
+ * @param peer Peer identity address
+ * @param map Report Map, valid until the next connection; NULL if it
+ *            could not be read, the default descriptor is used then
+ * @param len Report Map length
+ * @param cached true if the map came from the bond cache, not a GATT read
+ */
+typedef void (*hogp_map_cb_t)(const bt_addr_le_t *peer, const uint8_t *map,
+			      size_t len, bool cached);
+
+/**
+ * Callback type for Protocol Mode changes of a peripheral
+ * Its reports restart in the new mode, keys held so far are stale.
+ * @param peer Peripheral index
+ * @param boot true for Boot Protocol, false for Report Protocol
+ */
+typedef void (*hogp_pm_cb_t)(uint8_t peer, bool boot);
 
 /**
  * Initialize HOGP client
@@ -19,8 +43,26 @@ typedef void (*hogp_report_cb_t)(const uint8_t *report, uint8_t len);
  */
 int hogp_client_init(hogp_report_cb_t cb);
 
+/**
+ * Notify the HOGP client of a new connection
+ * Starts the time-to-first-report measurement
+ * @param conn BLE connection
+ * @param peer Peripheral index (0 to CONFIG_APP_MAX_PERIPHERALS - 1),
+ *             passed back with every report
+ * @return 0 on success, -EINVAL if the index is out of range
+ */
+int hogp_client_connected(struct bt_conn *conn, uint8_t peer);
+
+/**
+ * Notify the HOGP client that the connection is gone
+ * @param conn BLE connection
+ */
+void hogp_client_disconnected(struct bt_conn *conn);
+
 /**
  * Start HOGP service discovery on a connection
+ * Subscribes straight away with the handles cached for the bond when
+ * available, validated afterwards through the Database Hash
  * @param conn BLE connection
  * @return 0 on success, negative error code on failure
  */
@@ -28,8 +70,43 @@ int hogp_client_discover(struct bt_conn *conn);
 
 /**
  * Check if HOGP discovery is complete and subscribed to reports
- * @return true if ready, false otherwise
+ * @return true if ready on at least one peripheral, false otherwise
  */
 bool hogp_client_ready(void);
 
+/**
+ * Write an output report of a peripheral, e.g. keyboard LEDs
+ * Uses Write Without Response, may wait for a Bluetooth buffer: call
+ * from a thread, not from the Bluetooth RX thread.
+ * @param peer Peripheral index
+ * @param report_id Report ID of the output report; the peripheral's only
+ *                  output report is used if none has this ID
+ * @param data Report data
+ * @param len Report length
+ * @return 0 on success, -ENOTCONN if the peer is not ready,
+ *         -ENOENT if it has no output report, other negative error code
+ */
+int hogp_client_write_output(uint8_t peer, uint8_t report_id,
+			     const uint8_t *data, uint8_t len);
+
+/**
+ * Print time from connection to subscription and to the first report,
+ * for both the cached and the cold (full discovery) path
+ */
+void hogp_client_print_timing(void);
+
+/**
+ * Register the callback for Protocol Mode changes
+ * Called on the Bluetooth RX thread, like the report callback.
+ * @param cb Callback
+ */
+void hogp_client_set_pm_cb(hogp_pm_cb_t cb);
+
+/**
+ * Request the Report Map of every discovered peripheral
+ * Served from the bond cache when available, read over GATT otherwise
+ * @param cb Callback for the Report Map
+ */
+void hogp_client_set_map_cb(hogp_map_cb_t cb);
+
 #endif /* HOGP_CLIENT_H_ */
@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/logging/log.h>
+
+#include "idle.h"
+#include "conn_tuning.h"
+#include "status_led.h"
+#include "console.h"
+
+LOG_MODULE_REGISTER(idle, CONFIG_APP_LOG_LEVEL);
+
+#define IDLE_TIMEOUT_MS (CONFIG_APP_IDLE_TIMEOUT_S * MSEC_PER_SEC)
+
+/* Time and CPU use of one power state */
+struct state_stats {
+	uint64_t ms;
+	uint64_t busy_cycles;
+	uint64_t total_cycles;
+	uint32_t entries;
+};
+
+static const char *const state_names[IDLE_STATE_COUNT] = {
+	[IDLE_STATE_SCANNING] = "scanning",
+	[IDLE_STATE_ACTIVE] = "active",
+	[IDLE_STATE_IDLE] = "idle",
+};
+
+/*
+ * The state machine runs on the system work queue only. idle_activity()
+ * and the connection callbacks touch the atomics and kick the work.
+ */
+static enum idle_state state = IDLE_STATE_SCANNING;
+static struct state_stats stats[IDLE_STATE_COUNT];
+static int64_t state_since_ms;
+static uint64_t state_since_busy;
+static uint64_t state_since_total;
+
+static atomic_t link_count;
+static atomic_t last_activity;
+/* Idle parameters in use, cleared by the first report */
+static atomic_t idle_now;
+/* k_uptime_get_32() of the report that ended idle, until the link is back */
+static atomic_t wake_start;
+
+static uint32_t wakes;
+static uint32_t wake_ms_max;
+static uint64_t wake_ms_sum;
+static uint32_t wake_ms_count;
+
+static void check_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(check_work, check_handler);
+
+static void cpu_cycles(uint64_t *busy, uint64_t *total)
+{
+	*busy = 0;
+	*total = 0;
+
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+	k_thread_runtime_stats_t all;
+
+	if (k_thread_runtime_stats_all_get(&all) == 0) {
+		*busy = all.execution_cycles - all.idle_cycles;
+		*total = all.execution_cycles;
+	}
+#endif
+}
+
+/* Add the time since the last transition to s */
+static void account(struct state_stats *s)
+{
+	uint64_t busy, total;
+
+	cpu_cycles(&busy, &total);
+
+	s->ms += k_uptime_get() - state_since_ms;
+	s->busy_cycles += busy - state_since_busy;
+	s->total_cycles += total - state_since_total;
+}
+
+static void set_state(enum idle_state next)
+{
+	if (next == state) {
+		return;
+	}
+
+	account(&stats[state]);
+	state_since_ms = k_uptime_get();
+	cpu_cycles(&state_since_busy, &state_since_total);
+	LOG_DBG("%s -> %s", state_names[state], state_names[next]);
+
+	if (state == IDLE_STATE_IDLE) {
+		conn_tuning_set_idle(false);
+		status_led_set_idle(false);
+		console_set_idle(false);
+	}
+
+	state = next;
+	stats[next].entries++;
+
+	if (next == IDLE_STATE_IDLE) {
+		conn_tuning_set_idle(true);
+		status_led_set_idle(true);
+		console_set_idle(true);
+	}
+}
+
+static void check_handler(struct k_work *work)
+{
+	uint32_t since;
+
+	ARG_UNUSED(work);
+
+	if (atomic_get(&link_count) == 0) {
+		atomic_clear(&idle_now);
+		atomic_clear(&wake_start);
+		set_state(IDLE_STATE_SCANNING);
+		return;
+	}
+
+	if (state != IDLE_STATE_IDLE || !atomic_get(&idle_now)) {
+		if (state == IDLE_STATE_IDLE) {
+			wakes++;
+		}
+		set_state(IDLE_STATE_ACTIVE);
+	}
+
+	if (state == IDLE_STATE_IDLE) {
+		return;
+	}
+
+	since = k_uptime_get_32() - atomic_get(&last_activity);
+	if (since < IDLE_TIMEOUT_MS) {
+		k_work_reschedule(&check_work, K_MSEC(IDLE_TIMEOUT_MS - since));
+		return;
+	}
+
+	/* A report from here on ends idle again */
+	atomic_set(&idle_now, 1);
+	since = k_uptime_get_32() - atomic_get(&last_activity);
+	if (since < IDLE_TIMEOUT_MS && atomic_cas(&idle_now, 1, 0)) {
+		/* One arrived while checking */
+		k_work_reschedule(&check_work, K_MSEC(IDLE_TIMEOUT_MS - since));
+		return;
+	}
+
+	LOG_INF("Idle for %u s, peripheral latency %u", since / MSEC_PER_SEC,
+		CONFIG_APP_IDLE_LATENCY);
+	set_state(IDLE_STATE_IDLE);
+}
+
+void idle_activity(void)
+{
+	uint32_t now = k_uptime_get_32();
+
+	atomic_set(&last_activity, now);
+
+	if (atomic_cas(&idle_now, 1, 0)) {
+		atomic_set(&wake_start, now);
+		k_work_reschedule(&check_work, K_NO_WAIT);
+	}
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	ARG_UNUSED(conn);
+
+	if (err) {
+		return;
+	}
+
+	/* A new link starts out active */
+	atomic_inc(&link_count);
+	atomic_set(&last_activity, k_uptime_get_32());
+	atomic_clear(&idle_now);
+	k_work_reschedule(&check_work, K_NO_WAIT);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(reason);
+
+	if (atomic_dec(&link_count) <= 1) {
+		atomic_clear(&link_count);
+		k_work_reschedule(&check_work, K_NO_WAIT);
+	}
+}
+
+/* The first update after a wake-up: the link is at full rate again */
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+			     uint16_t latency, uint16_t timeout)
+{
+	uint32_t start = atomic_set(&wake_start, 0);
+	uint32_t ms;
+
+	ARG_UNUSED(conn);
+	ARG_UNUSED(interval);
+	ARG_UNUSED(latency);
+	ARG_UNUSED(timeout);
+
+	if (!start) {
+		return;
+	}
+
+	ms = k_uptime_get_32() - start;
+	wake_ms_max = MAX(wake_ms_max, ms);
+	wake_ms_sum += ms;
+	wake_ms_count++;
+}
+
+BT_CONN_CB_DEFINE(idle_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.le_param_updated = le_param_updated,
+};
+
+void idle_print(void)
+{
+	struct state_stats now[IDLE_STATE_COUNT];
+	enum idle_state current = state;
+	uint64_t total_ms = 0;
+
+	/* A transition racing the copy moves a few ms between two rows */
+	memcpy(now, stats, sizeof(now));
+	account(&now[current]);
+
+	for (int i = 0; i < IDLE_STATE_COUNT; i++) {
+		total_ms += now[i].ms;
+	}
+
+	printk("\nPower states (idle after %u s, peripheral latency %u",
+	       CONFIG_APP_IDLE_TIMEOUT_S, CONFIG_APP_IDLE_LATENCY);
+	if (CONFIG_APP_IDLE_INTERVAL) {
+		printk(", interval %u.%02u ms", CONFIG_APP_IDLE_INTERVAL * 125 / 100,
+		       CONFIG_APP_IDLE_INTERVAL * 125 % 100);
+	}
+	printk("):\n");
+	printk("  %-10s %12s %6s %6s %8s\n", "state", "time (s)", "time", "cpu",
+	       "entries");
+
+	for (int i = 0; i < IDLE_STATE_COUNT; i++) {
+		const struct state_stats *s = &now[i];
+
+		printk("  %-10s %8llu.%03llu %5llu%%", state_names[i],
+		       s->ms / MSEC_PER_SEC, s->ms % MSEC_PER_SEC,
+		       total_ms ? s->ms * 100 / total_ms : 0);
+		if (s->total_cycles) {
+			printk(" %5llu%%", s->busy_cycles * 100 / s->total_cycles);
+		} else {
+			printk(" %6s", "-");
+		}
+		printk(" %8u%s\n", s->entries, i == current ? "  <-" : "");
+	}
+
+	printk("  Wake-ups: %u", wakes);
+	if (wake_ms_count) {
+		printk(", back to full rate in %llu ms avg, %u ms max",
+		       wake_ms_sum / wake_ms_count, wake_ms_max);
+	}
+	printk("\n");
+
+	if (CONFIG_APP_IDLE_INTERVAL) {
+		printk("  First report after idle waits up to %u.%02u ms\n",
+		       CONFIG_APP_IDLE_INTERVAL * 125 / 100,
+		       CONFIG_APP_IDLE_INTERVAL * 125 % 100);
+	}
+	printk("\n");
+}
+
+CONSOLE_CMD_DEFINE(cmd_i_idle, "iI", "Show time and CPU load per power state",
+		   idle_print);
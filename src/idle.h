@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef IDLE_H_
+#define IDLE_H_
+
+/*
+ * Idle manager: after CONFIG_APP_IDLE_TIMEOUT_S without reports the
+ * links switch to the idle connection parameters (peripheral latency,
+ * optionally a longer interval) and the status LED goes dark. The first
+ * report switches back. Time and CPU use are accounted per power state.
+ * Compiled out unless CONFIG_APP_IDLE is set.
+ */
+
+/* Power states the time is accounted to */
+enum idle_state {
+	/* No peripheral connected, scanning */
+	IDLE_STATE_SCANNING,
+	/* Connected, profile parameters */
+	IDLE_STATE_ACTIVE,
+	/* Connected, idle parameters */
+	IDLE_STATE_IDLE,
+	IDLE_STATE_COUNT,
+};
+
+#if defined(CONFIG_APP_IDLE)
+
+/**
+ * Note a report from a peripheral
+ * Leaves idle on the first report after it. Call on every report.
+ * Safe to call from any thread
+ */
+void idle_activity(void);
+
+/**
+ * Print time, CPU load and entries per power state, and the wake-ups
+ */
+void idle_print(void);
+
+#else
+
+static inline void idle_activity(void) {}
+static inline void idle_print(void) {}
+
+#endif /* CONFIG_APP_IDLE */
+
+#endif /* IDLE_H_ */
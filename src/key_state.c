@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/math_extras.h>
+
+#include "key_state.h"
+#include "usb_hid.h"
+
+/* Keyboard/Keypad page usages */
+#define USAGE_ERROR_ROLLOVER 0x01
+#define USAGE_FIRST_KEY      0x04
+#define USAGE_LEFT_CTRL      0xE0
+#define USAGE_RIGHT_GUI      0xE7
+
+/* Both layouts: modifiers, reserved byte, then the keys */
+#define REPORT_KEYS_OFFSET 2
+#define KEY_SLOTS (APP_USB_HID_KEYBOARD_SIZE - REPORT_KEYS_OFFSET)
+#define NKRO_BITMAP_LEN (APP_USB_HID_NKRO_USAGE_COUNT / 8)
+
+BUILD_ASSERT(APP_USB_HID_NKRO_SIZE == REPORT_KEYS_OFFSET + NKRO_BITMAP_LEN,
+	     "NKRO report layout does not match its usage count");
+
+static bool usage_test(const uint32_t *usages, uint8_t usage)
+{
+	return usages[usage / 32] & BIT(usage % 32);
+}
+
+static void usage_set(uint32_t *usages, uint8_t usage)
+{
+	usages[usage / 32] |= BIT(usage % 32);
+}
+
+int key_state_decode_6kro(struct key_state *state, const uint8_t *report,
+			  uint8_t len)
+{
+	struct key_state next = { .mods = len ? report[0] : 0 };
+
+	for (uint8_t i = REPORT_KEYS_OFFSET; i < len; i++) {
+		uint8_t usage = report[i];
+
+		if (usage >= USAGE_LEFT_CTRL && usage <= USAGE_RIGHT_GUI) {
+			next.mods |= BIT(usage - USAGE_LEFT_CTRL);
+		} else if (usage >= USAGE_FIRST_KEY) {
+			usage_set(next.usages, usage);
+		} else if (usage != 0) {
+			/* ErrorRollOver, POSTFail or ErrorUndefined */
+			return -EAGAIN;
+		}
+	}
+
+	*state = next;
+	return 0;
+}
+
+void key_state_decode_nkro(struct key_state *state, const uint8_t *report,
+			   uint8_t len)
+{
+	struct key_state next = { .mods = len ? report[0] : 0 };
+	const uint8_t *bitmap = &report[REPORT_KEYS_OFFSET];
+	uint8_t n = len > REPORT_KEYS_OFFSET ?
+		    MIN(len - REPORT_KEYS_OFFSET, KEY_STATE_WORDS * 4) : 0;
+
+	for (uint8_t i = 0; i < n; i++) {
+		next.usages[i / 4] |= (uint32_t)bitmap[i] << (8 * (i % 4));
+	}
+
+	/* Modifier usages belong in the modifier byte, 0x00-0x03 are no keys */
+	next.mods |= (next.usages[USAGE_LEFT_CTRL / 32] >> (USAGE_LEFT_CTRL % 32)) & 0xFF;
+	next.usages[USAGE_LEFT_CTRL / 32] &= ~(0xFFU << (USAGE_LEFT_CTRL % 32));
+	next.usages[0] &= ~BIT_MASK(USAGE_FIRST_KEY);
+
+	*state = next;
+}
+
+bool key_state_equal(const struct key_state *a, const struct key_state *b)
+{
+	if (a->mods != b->mods) {
+		return false;
+	}
+
+	for (int i = 0; i < KEY_STATE_WORDS; i++) {
+		if (a->usages[i] != b->usages[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void key_state_encode_6kro(const struct key_state *state, const uint8_t *prev,
+			   uint8_t *out)
+{
+	uint32_t placed[KEY_STATE_WORDS] = { 0 };
+	uint8_t slots[KEY_SLOTS];
+	uint8_t next_free = 0;
+
+	/* Keys still pressed keep their slot */
+	for (int i = 0; i < KEY_SLOTS; i++) {
+		uint8_t usage = prev[REPORT_KEYS_OFFSET + i];
+
+		if (usage >= USAGE_FIRST_KEY && usage_test(state->usages, usage) &&
+		    !usage_test(placed, usage)) {
+			slots[i] = usage;
+			usage_set(placed, usage);
+		} else {
+			slots[i] = 0;
+		}
+	}
+
+	/* Newly pressed keys take the free slots, lowest usage first */
+	for (int w = 0; w < KEY_STATE_WORDS; w++) {
+		uint32_t rest = state->usages[w] & ~placed[w];
+
+		while (rest) {
+			uint8_t usage = w * 32 + u32_count_trailing_zeros(rest);
+
+			rest &= rest - 1;
+			if (usage > APP_USB_HID_KEYBOARD_USAGE_MAX) {
+				/* Not in the key array's range */
+				continue;
+			}
+
+			while (next_free < KEY_SLOTS && slots[next_free]) {
+				next_free++;
+			}
+
+			if (next_free == KEY_SLOTS) {
+				/* Phantom state: more keys than slots */
+				memset(slots, USAGE_ERROR_ROLLOVER, sizeof(slots));
+				goto done;
+			}
+
+			slots[next_free] = usage;
+		}
+	}
+
+done:
+	out[0] = state->mods;
+	out[1] = 0;
+	memcpy(&out[REPORT_KEYS_OFFSET], slots, sizeof(slots));
+}
+
+void key_state_encode_nkro(const struct key_state *state, uint8_t *out)
+{
+	out[0] = state->mods;
+	out[1] = 0;
+
+	for (int i = 0; i < NKRO_BITMAP_LEN; i++) {
+		out[REPORT_KEYS_OFFSET + i] = state->usages[i / 4] >> (8 * (i % 4));
+	}
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef KEY_STATE_H_
+#define KEY_STATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Pressed keys of one keyboard, independent of the report format it
+ * came in: the modifier byte and a bitmap of usages 0x00-0xFF of the
+ * Keyboard/Keypad page. Keyboard reports are decoded into it and USB
+ * reports generated from it, so the format the host gets need not be
+ * the one the peripheral sends.
+ */
+#define KEY_STATE_WORDS (256 / 32)
+
+struct key_state {
+	uint8_t mods;
+	uint32_t usages[KEY_STATE_WORDS];
+};
+
+/**
+ * Decode a boot / 6KRO keyboard report
+ * Usages 0xE0-0xE7 in the key array count as modifiers.
+ * @param state Key state to replace
+ * @param report Modifiers, reserved byte, key array
+ * @param len Report length
+ * @return 0 on success, -EAGAIN if the report only signals rollover
+ *         (the keyboard lost track), state is left unchanged
+ */
+int key_state_decode_6kro(struct key_state *state, const uint8_t *report,
+			  uint8_t len);
+
+/**
+ * Decode an NKRO keyboard report
+ * @param state Key state to replace
+ * @param report Modifiers, reserved byte, usage bitmap from usage 0
+ * @param len Report length, usages beyond it are released
+ */
+void key_state_decode_nkro(struct key_state *state, const uint8_t *report,
+			   uint8_t len);
+
+/**
+ * Compare two key states
+ * @return true if the same modifiers and keys are pressed
+ */
+bool key_state_equal(const struct key_state *a, const struct key_state *b);
+
+/**
+ * Generate a 6KRO report (APP_USB_HID_KEYBOARD_SIZE bytes)
+ * Keys pressed in prev keep their slot and new keys take free ones, so
+ * only the changed slots differ. With more keys than slots every slot
+ * reports ErrorRollOver. Usages beyond the 6KRO descriptor are left out.
+ * @param state Key state
+ * @param prev Report generated last time, may be the same buffer as out
+ * @param out Report to fill
+ */
+void key_state_encode_6kro(const struct key_state *state, const uint8_t *prev,
+			   uint8_t *out);
+
+/**
+ * Generate an NKRO report (APP_USB_HID_NKRO_SIZE bytes)
+ * @param state Key state
+ * @param out Report to fill
+ */
+void key_state_encode_nkro(const struct key_state *state, uint8_t *out);
+
+#endif /* KEY_STATE_H_ */
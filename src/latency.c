@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/timing/timing.h>
+#include <zephyr/bluetooth/gap.h>
+#include <zephyr/logging/log.h>
+
+#include "latency.h"
+#include "console.h"
+
+LOG_MODULE_REGISTER(latency, CONFIG_APP_LOG_LEVEL);
+
+#define BUCKET_COUNT CONFIG_APP_LATENCY_BUCKET_COUNT
+
+struct latency_hist {
+	atomic_t buckets[BUCKET_COUNT];
+	atomic_t count;
+	atomic_t max_cycles;
+};
+
+static struct latency_hist hist[LATENCY_STAGE_COUNT];
+
+/* Cycles per histogram bucket, fixed at init to keep division cheap */
+static uint32_t bucket_cycles = 1;
+static uint32_t cycles_per_us = 1;
+
+/* Link parameters the current samples belong to */
+static struct {
+	uint16_t interval;
+	uint16_t latency;
+	uint8_t phy;
+} link;
+
+static const char *const stage_names[LATENCY_STAGE_COUNT] = {
+	[LATENCY_STAGE_QUEUE] = "notify->write",
+	[LATENCY_STAGE_USB] = "write->complete",
+	[LATENCY_STAGE_TOTAL] = "notify->complete",
+	[LATENCY_STAGE_EP_WAIT] = "endpoint wait",
+	[LATENCY_STAGE_NOTIFY_PHASE] = "SOF->notify",
+	[LATENCY_STAGE_POLL_PHASE] = "SOF->complete",
+};
+
+void latency_init(void)
+{
+	timing_init();
+	timing_start();
+
+	cycles_per_us = MAX(timing_freq_get_mhz(), 1);
+	bucket_cycles = cycles_per_us * CONFIG_APP_LATENCY_BUCKET_US;
+
+	LOG_INF("Latency instrumentation: %u MHz counter, %u us buckets",
+		cycles_per_us, CONFIG_APP_LATENCY_BUCKET_US);
+}
+
+uint32_t latency_now(void)
+{
+	return (uint32_t)timing_counter_get();
+}
+
+uint64_t latency_cycles_to_us(uint64_t cycles)
+{
+	return cycles / cycles_per_us;
+}
+
+void latency_record(enum latency_stage stage, uint32_t start, uint32_t end)
+{
+	struct latency_hist *h = &hist[stage];
+	uint32_t cycles = end - start;
+	uint32_t bucket = MIN(cycles / bucket_cycles, BUCKET_COUNT - 1);
+	atomic_val_t max;
+
+	atomic_inc(&h->buckets[bucket]);
+	atomic_inc(&h->count);
+
+	do {
+		max = atomic_get(&h->max_cycles);
+		if ((uint32_t)max >= cycles) {
+			break;
+		}
+	} while (!atomic_cas(&h->max_cycles, max, cycles));
+}
+
+void latency_record_phase(enum latency_stage stage, uint32_t ref, uint32_t ts,
+			  uint32_t period_us)
+{
+	int32_t period = period_us * cycles_per_us;
+	int32_t phase = (int32_t)(ts - ref) % period;
+
+	if (phase < 0) {
+		phase += period;
+	}
+
+	latency_record(stage, 0, phase);
+}
+
+/* Upper bound (us) of the bucket holding the given percentile */
+static uint32_t percentile_us(const struct latency_hist *h, uint32_t count,
+			      uint32_t pct)
+{
+	uint32_t target = DIV_ROUND_UP(count * pct, 100);
+	uint32_t seen = 0;
+
+	for (int i = 0; i < BUCKET_COUNT; i++) {
+		seen += atomic_get(&h->buckets[i]);
+		if (seen >= target) {
+			if (i == BUCKET_COUNT - 1) {
+				/* Overflow bucket: best we know is the max */
+				return (uint32_t)atomic_get(&h->max_cycles) / cycles_per_us;
+			}
+			return (i + 1) * CONFIG_APP_LATENCY_BUCKET_US;
+		}
+	}
+
+	return 0;
+}
+
+void latency_set_link(uint16_t interval, uint16_t latency, uint8_t phy)
+{
+	link.interval = interval;
+	link.latency = latency;
+	link.phy = phy;
+}
+
+/*
+ * Frame phase distributions, one column per bucket. A narrow poll peak
+ * is where the host takes the report; notifications landing just
+ * before it wait least for the IN transfer.
+ */
+static void print_phases(void)
+{
+	uint32_t buckets = MIN(DIV_ROUND_UP(LATENCY_USB_FRAME_US,
+					    CONFIG_APP_LATENCY_BUCKET_US),
+			       BUCKET_COUNT);
+
+	printk("\nUSB frame phase (%% per %u us after SOF)\n",
+	       CONFIG_APP_LATENCY_BUCKET_US);
+
+	for (int i = LATENCY_STAGE_NOTIFY_PHASE; i <= LATENCY_STAGE_POLL_PHASE; i++) {
+		const struct latency_hist *h = &hist[i];
+		uint32_t count = atomic_get(&h->count);
+
+		printk("  %-16s", stage_names[i]);
+		for (uint32_t b = 0; b < buckets; b++) {
+			printk(" %3u", count ? (uint32_t)atomic_get(&h->buckets[b]) *
+					       100 / count : 0);
+		}
+		printk("\n");
+	}
+}
+
+void latency_print(void)
+{
+	if (link.interval) {
+		printk("\nLink: %u.%02u ms interval, latency %u, %s PHY",
+		       link.interval * 125 / 100, link.interval * 125 % 100,
+		       link.latency,
+		       link.phy == BT_GAP_LE_PHY_2M ? "2M" :
+		       link.phy == BT_GAP_LE_PHY_CODED ? "Coded" : "1M");
+	} else {
+		printk("\nLink: not connected");
+	}
+
+	printk("\nLatency (us)         count      p50      p99      max\n");
+
+	for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+		const struct latency_hist *h = &hist[i];
+		uint32_t count = atomic_get(&h->count);
+
+		if (!IS_ENABLED(CONFIG_APP_USB_SOF_ALIGN) &&
+		    i >= LATENCY_STAGE_NOTIFY_PHASE) {
+			continue;
+		}
+
+		if (count == 0) {
+			printk("  %-16s %8u        -        -        -\n",
+			       stage_names[i], 0);
+			continue;
+		}
+
+		printk("  %-16s %8u %8u %8u %8u\n", stage_names[i], count,
+		       percentile_us(h, count, 50), percentile_us(h, count, 99),
+		       (uint32_t)atomic_get(&h->max_cycles) / cycles_per_us);
+	}
+
+	if (IS_ENABLED(CONFIG_APP_USB_SOF_ALIGN)) {
+		print_phases();
+	}
+
+	printk("\n");
+}
+
+void latency_reset(void)
+{
+	for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+		struct latency_hist *h = &hist[i];
+
+		for (int b = 0; b < BUCKET_COUNT; b++) {
+			atomic_clear(&h->buckets[b]);
+		}
+		atomic_clear(&h->count);
+		atomic_clear(&h->max_cycles);
+	}
+}
+
+static void cmd_reset(void)
+{
+	latency_reset();
+	printk("\nLatency histogram reset.\n\n");
+}
+
+CONSOLE_CMD_DEFINE(cmd_r_latency_reset, "rR", "Reset keystroke latency histogram",
+		   cmd_reset);
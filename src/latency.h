@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+/* Measured intervals along the report path */
+enum latency_stage {
+	/* BLE notification -> hid_int_ep_write() */
+	LATENCY_STAGE_QUEUE,
+	/* hid_int_ep_write() -> IN transfer complete */
+	LATENCY_STAGE_USB,
+	/* BLE notification -> IN transfer complete */
+	LATENCY_STAGE_TOTAL,
+	/* TX thread blocked waiting for the IN endpoint to free up */
+	LATENCY_STAGE_EP_WAIT,
+	/* USB frame phases, see latency_record_phase() (CONFIG_APP_USB_SOF_ALIGN) */
+	/* SOF -> BLE notification: where in the frame reports arrive */
+	LATENCY_STAGE_NOTIFY_PHASE,
+	/* SOF -> IN transfer complete: where in the frame the host polls */
+	LATENCY_STAGE_POLL_PHASE,
+	LATENCY_STAGE_COUNT,
+};
+
+/* Full-speed USB frame */
+#define LATENCY_USB_FRAME_US 1000
+
+#if defined(CONFIG_APP_LATENCY_STATS)
+
+/**
+ * Initialize the cycle counter used for timestamps
+ */
+void latency_init(void);
+
+/**
+ * Take a timestamp
+ * @return Free-running cycle count
+ */
+uint32_t latency_now(void);
+
+/**
+ * Convert a difference of timestamps to microseconds
+ * @param cycles Counter cycles
+ * @return Microseconds, rounded down
+ */
+uint64_t latency_cycles_to_us(uint64_t cycles);
+
+/**
+ * Record one interval into the histogram of a stage
+ * Safe to call from ISR context
+ * @param stage Stage the interval belongs to
+ * @param start Timestamp at the start of the interval
+ * @param end Timestamp at the end of the interval
+ */
+void latency_record(enum latency_stage stage, uint32_t start, uint32_t end);
+
+/**
+ * Record the phase of an event within a periodic frame
+ * The phase is the time since the reference, modulo the period; the
+ * reference may be older or newer than the event.
+ * Safe to call from ISR context
+ * @param stage Stage the phase belongs to
+ * @param ref Timestamp of a frame start, e.g. the last USB SOF
+ * @param ts Timestamp of the event
+ * @param period_us Frame period
+ */
+void latency_record_phase(enum latency_stage stage, uint32_t ref, uint32_t ts,
+			  uint32_t period_us);
+
+/**
+ * Print p50/p99/max for every stage on the console
+ */
+void latency_print(void);
+
+/**
+ * Clear all histograms
+ */
+void latency_reset(void);
+
+/**
+ * Record the link parameters the samples were taken under
+ * Printed with the histograms so runs can be compared
+ * @param interval Connection interval (1.25 ms units), 0 when disconnected
+ * @param latency Peripheral latency
+ * @param phy TX PHY (BT_GAP_LE_PHY_*)
+ */
+void latency_set_link(uint16_t interval, uint16_t latency, uint8_t phy);
+
+#else
+
+static inline void latency_init(void) {}
+static inline uint32_t latency_now(void) { return 0; }
+static inline uint64_t latency_cycles_to_us(uint64_t cycles) { return 0; }
+static inline void latency_record(enum latency_stage stage, uint32_t start,
+				  uint32_t end) {}
+static inline void latency_record_phase(enum latency_stage stage, uint32_t ref,
+					uint32_t ts, uint32_t period_us) {}
+static inline void latency_print(void) {}
+static inline void latency_reset(void) {}
+static inline void latency_set_link(uint16_t interval, uint16_t latency,
+				    uint8_t phy) {}
+
+#endif /* CONFIG_APP_LATENCY_STATS */
+
+#endif /* LATENCY_H_ */
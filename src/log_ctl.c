@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/logging/log_ctrl.h>
+#include <zephyr/logging/log_backend.h>
+
+#include "log_ctl.h"
+#include "console.h"
+
+static const char *const level_names[] = {
+	[LOG_LEVEL_NONE] = "off",
+	[LOG_LEVEL_ERR] = "err",
+	[LOG_LEVEL_WRN] = "wrn",
+	[LOG_LEVEL_INF] = "inf",
+	[LOG_LEVEL_DBG] = "dbg",
+};
+
+void log_ctl_init(void)
+{
+	uint32_t count = log_src_cnt_get(Z_LOG_LOCAL_DOMAIN_ID);
+
+	for (uint32_t i = 0; i < count; i++) {
+		log_filter_set(NULL, Z_LOG_LOCAL_DOMAIN_ID, i,
+			       CONFIG_APP_LOG_CTL_BOOT_LEVEL);
+	}
+}
+
+int log_ctl_set(const char *module, uint32_t level)
+{
+	uint32_t count = log_src_cnt_get(Z_LOG_LOCAL_DOMAIN_ID);
+	bool all = strcmp(module, "all") == 0;
+	int changed = 0;
+
+	if (level > LOG_LEVEL_DBG) {
+		return -EINVAL;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		const char *name = log_source_name_get(Z_LOG_LOCAL_DOMAIN_ID, i);
+
+		if (!all && (!name || strcmp(name, module) != 0)) {
+			continue;
+		}
+
+		log_filter_set(NULL, Z_LOG_LOCAL_DOMAIN_ID, i, level);
+		changed++;
+	}
+
+	return changed ? changed : -ENOENT;
+}
+
+void log_ctl_print(void)
+{
+	uint32_t count = log_src_cnt_get(Z_LOG_LOCAL_DOMAIN_ID);
+	/* log_ctl_set() applies to all backends, the first one is enough */
+	const struct log_backend *backend = log_backend_get(0);
+
+	printk("\nLog sources (runtime / compiled level):\n");
+
+	for (uint32_t i = 0; i < count; i++) {
+		const char *name = log_source_name_get(Z_LOG_LOCAL_DOMAIN_ID, i);
+		uint32_t runtime = log_filter_get(backend, Z_LOG_LOCAL_DOMAIN_ID, i, true);
+		uint32_t compiled = log_filter_get(NULL, Z_LOG_LOCAL_DOMAIN_ID, i, false);
+
+		printk("  %-20s %s / %s\n", name ? name : "?",
+		       level_names[MIN(runtime, LOG_LEVEL_DBG)],
+		       level_names[MIN(compiled, LOG_LEVEL_DBG)]);
+	}
+
+	printk("\n");
+}
+
+static void cmd_log_level(void)
+{
+	printk("\nLog level (<module|all> <0-4>, empty to list): ");
+}
+
+/* Apply a "<module|all> <level>" line, list the sources if empty */
+static void cmd_log_level_apply(char *line)
+{
+	char *level = strchr(line, ' ');
+	char *end;
+	unsigned long value;
+	int ret;
+
+	if (line[0] == '\0') {
+		log_ctl_print();
+		return;
+	}
+
+	if (!level) {
+		printk("Usage: <module|all> <0-4>\n\n");
+		return;
+	}
+
+	*level++ = '\0';
+	value = strtoul(level, &end, 10);
+	if (end == level || value > LOG_LEVEL_DBG) {
+		printk("Level must be 0 (off) to 4 (debug)\n\n");
+		return;
+	}
+
+	ret = log_ctl_set(line, value);
+	if (ret < 0) {
+		printk("Unknown log module \"%s\"\n\n", line);
+		return;
+	}
+
+	printk("Log level %lu set on %d module(s)\n\n", value, ret);
+}
+
+CONSOLE_CMD_INPUT_DEFINE(cmd_v_log_level, "vV",
+			 "Set log level: <module|all> <0-4>",
+			 CONSOLE_INPUT_LINE, cmd_log_level, cmd_log_level_apply);
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef LOG_CTL_H_
+#define LOG_CTL_H_
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/*
+ * Log at most once per CONFIG_APP_LOG_RATELIMIT_MS from this call site,
+ * for messages that could otherwise fire on every report. Skipped
+ * messages are not formatted at all.
+ *   APP_LOG_RATELIMIT(LOG_WRN, "Bad report: %d", err);
+ */
+#define APP_LOG_RATELIMIT(log_macro, ...)                                      \
+	do {                                                                   \
+		static int64_t _next_log;                                      \
+		int64_t _now = k_uptime_get();                                 \
+									       \
+		if (_now >= _next_log) {                                       \
+			_next_log = _now + CONFIG_APP_LOG_RATELIMIT_MS;        \
+			log_macro(__VA_ARGS__);                                \
+		}                                                              \
+	} while (0)
+
+#if defined(CONFIG_APP_LOG_CTL)
+
+/**
+ * Lower every log source to its boot-time runtime level
+ * Application modules are compiled with debug messages so they can be
+ * enabled later, they start out at CONFIG_APP_LOG_CTL_BOOT_LEVEL.
+ */
+void log_ctl_init(void);
+
+/**
+ * Set the runtime level of one log source, or of all of them
+ * @param module Source name as given to LOG_MODULE_REGISTER(), or "all"
+ * @param level LOG_LEVEL_NONE to LOG_LEVEL_DBG, capped at the compiled level
+ * @return Number of sources changed, -ENOENT if no source has that name
+ */
+int log_ctl_set(const char *module, uint32_t level);
+
+/**
+ * Print every log source with its runtime and compiled level
+ */
+void log_ctl_print(void);
+
+#else
+
+static inline void log_ctl_init(void) {}
+static inline int log_ctl_set(const char *module, uint32_t level)
+{
+	return -ENOTSUP;
+}
+static inline void log_ctl_print(void) {}
+
+#endif /* CONFIG_APP_LOG_CTL */
+
+#endif /* LOG_CTL_H_ */
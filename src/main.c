@@ -11,32 +11,80 @@
  * 1. USB initializes and enumerates as HID keyboard
  * 2. BLE scans for HID devices (Corne keyboard)
  * 3. Connects and pairs (passkey displayed on USB serial)
- * 4. Subscribes to boot keyboard reports
- * 5. Forwards all reports from BLE to USB
+ * 4. Subscribes to all input reports
+ * 5. Forwards keyboard, consumer, mouse and NKRO reports from BLE to USB
  */
 
 #include <zephyr/kernel.h>
-#include <zephyr/device.h>
-#include <zephyr/drivers/gpio.h>
-#include <zephyr/drivers/uart.h>
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/logging/log.h>
 
 #include "usb_hid.h"
+#include "trace.h"
 #include "ble_central.h"
 #include "hid_bridge.h"
-#include "pairing.h"
+#include "latency.h"
+#include "hogp_client.h"
+#include "conn_tuning.h"
+#include "app_event.h"
+#include "status_led.h"
+#include "log_ctl.h"
+#include "app_stats.h"
+#include "console.h"
 
-LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 
-/* Status LED - blinks during scanning, solid when connected */
-static const struct gpio_dt_spec status_led = GPIO_DT_SPEC_GET_OR(DT_ALIAS(led0), gpios, {0});
+/* Boot milestones, logged once with their time since boot */
+enum boot_phase {
+	BOOT_PHASE_USB_INIT,
+	BOOT_PHASE_BT_READY,
+	BOOT_PHASE_BONDS_LOADED,
+	BOOT_PHASE_SCANNING,
+	BOOT_PHASE_USB_CONFIGURED,
+	BOOT_PHASE_CONSOLE_OPEN,
+	BOOT_PHASE_CONNECTED,
+	BOOT_PHASE_HID_READY,
+	BOOT_PHASE_COUNT,
+};
 
-/* Console UART for command input */
-static const struct device *console_dev = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
+static const char *const boot_phase_names[BOOT_PHASE_COUNT] = {
+	[BOOT_PHASE_USB_INIT] = "USB HID registered",
+	[BOOT_PHASE_BT_READY] = "Bluetooth ready",
+	[BOOT_PHASE_BONDS_LOADED] = "bonds loaded",
+	[BOOT_PHASE_SCANNING] = "reconnect started",
+	[BOOT_PHASE_USB_CONFIGURED] = "USB configured",
+	[BOOT_PHASE_CONSOLE_OPEN] = "console open",
+	[BOOT_PHASE_CONNECTED] = "first connection",
+	[BOOT_PHASE_HID_READY] = "first keyboard ready",
+};
 
-/* Command state for bond clearing confirmation */
-static bool awaiting_clear_confirm = false;
+/* Milliseconds since boot, 0 if not reached */
+static uint32_t boot_phase_ms[BOOT_PHASE_COUNT];
+
+static void boot_phase_mark(enum boot_phase phase)
+{
+	if (boot_phase_ms[phase]) {
+		return;
+	}
+
+	boot_phase_ms[phase] = MAX(k_uptime_get_32(), 1);
+	LOG_INF("Boot: %s at %u ms", boot_phase_names[phase], boot_phase_ms[phase]);
+}
+
+static void print_boot_phases(void)
+{
+	printk("\nBoot timeline:\n");
+
+	for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+		if (boot_phase_ms[i]) {
+			printk("  %-22s %6u ms\n", boot_phase_names[i], boot_phase_ms[i]);
+		} else {
+			printk("  %-22s      -\n", boot_phase_names[i]);
+		}
+	}
+
+	printk("\n");
+}
 
 static void print_banner(void)
 {
@@ -52,152 +100,159 @@ static void print_banner(void)
 	printk("Pairing passkeys will be displayed here.\n");
 	printk("Connect with: screen /dev/tty.usbmodem*\n");
 	printk("\n");
-	printk("Commands:\n");
-	printk("  c - Clear all Bluetooth bonds\n");
+	console_print_help();
 	printk("\n");
+
+	if (!ble_central_is_connected()) {
+		printk("Scanning for Bluetooth HID keyboards.\n");
+		printk("Put your keyboard in pairing mode now.\n");
+		printk("(For Magic Keyboard: hold power 5+ sec)\n");
+		printk("\n");
+	}
 }
 
-/*
- * Process serial command input
- * Returns true if a command was processed
- */
-static void process_serial_commands(void)
+/* Link, latency, reconnect and boot timing */
+static void cmd_timing(void)
 {
-	unsigned char c;
-
-	/* Non-blocking poll for input */
-	while (uart_poll_in(console_dev, &c) == 0) {
-		if (awaiting_clear_confirm) {
-			if (c == 'y' || c == 'Y') {
-				printk("\nClearing all Bluetooth bonds...\n");
-				pairing_clear_bonds();
-				printk("All bonds cleared. Device will scan for new keyboards.\n");
-				printk("You may need to put your keyboard in pairing mode again.\n\n");
-
-				/* Restart scanning if not connected */
-				if (!ble_central_is_connected()) {
-					ble_central_start_scan();
-				}
-			} else if (c == 'n' || c == 'N') {
-				printk("\nBond clearing cancelled.\n\n");
-			} else {
-				printk("\nInvalid input. Bond clearing cancelled.\n\n");
-			}
-			awaiting_clear_confirm = false;
-		} else if (c == 'c' || c == 'C') {
-			printk("\n");
-			printk("========================================\n");
-			printk("  CLEAR ALL BLUETOOTH BONDS?\n");
-			printk("========================================\n");
-			printk("This will remove all paired devices.\n");
-			printk("You will need to re-pair your keyboard.\n");
-			printk("\n");
-			printk("Press 'y' to confirm, any other key to cancel: ");
-			awaiting_clear_confirm = true;
-		}
+	conn_tuning_print();
+	latency_print();
+	hogp_client_print_timing();
+	print_boot_phases();
+}
+
+CONSOLE_CMD_DEFINE(cmd_l_timing, "lL",
+		   "Show keystroke latency, reconnect and boot timing", cmd_timing);
+
+static void cmd_stats(void)
+{
+	app_stats_print();
+	app_usb_hid_print_host();
+}
+
+/* The counters as one binary record, for scripts/stats_host.py */
+static void cmd_stats_record(void)
+{
+	uint8_t record[APP_STATS_RECORD_SIZE];
+	int len = app_stats_record(record, sizeof(record));
+
+	if (len > 0) {
+		console_write_raw(record, len);
 	}
 }
 
+CONSOLE_CMD_DEFINE(cmd_t_stats, "t",
+		   "Show BLE, bridge and USB counters (T: binary record)", cmd_stats);
+CONSOLE_CMD_DEFINE(cmd_t_stats_record, "T", NULL, cmd_stats_record);
+
 int main(void)
 {
 	int err;
 
 	LOG_INF("BLE-to-USB-HID Bridge starting...");
 
-	/* Initialize USB HID keyboard first (before USB is enabled) */
-	LOG_INF("Initializing USB HID...");
+	log_ctl_init();
+	latency_init();
+	trace_init();
+
+	/* Not fatal: the bridge works without its LED */
+	err = status_led_init();
+	if (err) {
+		LOG_WRN("Status LED unavailable: %d", err);
+	}
+
+	/*
+	 * USB first: usb_enable() returns at once and the host enumerates
+	 * the device while the Bluetooth controller comes up. Nothing waits
+	 * on either; each posts an event when it is done.
+	 */
 	err = app_usb_hid_init();
 	if (err) {
 		LOG_ERR("USB HID init failed: %d", err);
 		/* Continue anyway - BLE scanning might still work */
 	}
+	boot_phase_mark(BOOT_PHASE_USB_INIT);
 
-	/* Wait for USB to enumerate and console to be ready */
-	LOG_INF("Waiting for USB enumeration...");
-	k_msleep(2000);
-
-	print_banner();
-	k_msleep(100);
+	err = ble_central_init();
+	if (err) {
+		LOG_ERR("BLE init failed: %d", err);
+	}
 
 	/* Initialize HID bridge (also initializes HOGP client) */
-	printk("Initializing HID bridge...\n");
 	err = hid_bridge_init();
 	if (err) {
-		printk("ERROR: HID bridge init failed: %d\n", err);
+		LOG_ERR("HID bridge init failed: %d", err);
 		return err;
 	}
-	printk("HID bridge OK\n");
-	k_msleep(100);
 
-	/* Initialize BLE central */
-	printk("Initializing BLE...\n");
-	err = ble_central_init();
+	/* Serial commands arrive from the UART interrupt */
+	err = console_init();
 	if (err) {
-		printk("ERROR: BLE init failed: %d\n", err);
-		return err;
+		LOG_WRN("Console input unavailable (%d) - serial commands disabled", err);
 	}
-	printk("BLE OK\n");
-	k_msleep(100);
 
-	/* Start scanning for HID devices */
-	printk("Starting BLE scan...\n");
-	err = ble_central_start_scan();
-	if (err) {
-		printk("ERROR: Failed to start scanning: %d\n", err);
-		return err;
-	}
+	status_led_set_pattern(STATUS_LED_SLOW_BLINK);
 
-	printk("\n");
-	printk("==========================================\n");
-	printk("  SCANNING FOR BLUETOOTH HID KEYBOARDS\n");
-	printk("==========================================\n");
-	printk("Put your keyboard in pairing mode now.\n");
-	printk("(For Magic Keyboard: hold power 5+ sec)\n");
-	printk("\n");
+	/* Main loop - sleeps until a module posts an event */
+	while (1) {
+		uint32_t events = app_event_wait();
 
-	/* Verify console device is ready */
-	if (!device_is_ready(console_dev)) {
-		LOG_WRN("Console device not ready - serial commands disabled");
-	}
+		if (events & APP_EVENT_BT_READY) {
+			boot_phase_mark(BOOT_PHASE_BT_READY);
 
-	/* Main loop - status monitoring */
-	bool was_connected = false;
-	int blink_counter = 0;
+			/* Bonds, then straight to the reconnect policy */
+			err = ble_central_start();
+			if (err) {
+				printk("ERROR: BLE init failed: %d\n", err);
+			} else {
+				boot_phase_mark(BOOT_PHASE_BONDS_LOADED);
 
-	while (1) {
-		/* Check for serial commands */
-		if (device_is_ready(console_dev)) {
-			process_serial_commands();
+				err = ble_central_start_scan();
+				if (err) {
+					printk("ERROR: Failed to start scanning: %d\n", err);
+				} else {
+					boot_phase_mark(BOOT_PHASE_SCANNING);
+				}
+			}
 		}
 
-		bool connected = ble_central_is_connected();
+		if (events & APP_EVENT_USB_CONFIGURED) {
+			boot_phase_mark(BOOT_PHASE_USB_CONFIGURED);
+			/* A new enumeration: the host opens the port again */
+			console_watch();
+		}
 
-		if (connected != was_connected) {
-			if (connected) {
-				LOG_INF("=== CONNECTED ===");
-				printk("\nConnected to Bluetooth keyboard!\n\n");
-				/* Solid LED when connected */
-				if (status_led.port) {
-					gpio_pin_set_dt(&status_led, 1);
-				}
-			} else {
-				LOG_INF("=== DISCONNECTED ===");
-				printk("\nDisconnected from Bluetooth keyboard.\n");
-				printk("Scanning for devices...\n\n");
-			}
-			was_connected = connected;
+		if (events & APP_EVENT_CONSOLE_OPEN) {
+			boot_phase_mark(BOOT_PHASE_CONSOLE_OPEN);
+			print_banner();
 		}
 
-		/* Blink LED while scanning */
-		if (!connected && status_led.port) {
-			blink_counter++;
-			if (blink_counter >= 10) {
-				gpio_pin_toggle_dt(&status_led);
-				blink_counter = 0;
-			}
+		if (events & APP_EVENT_DISCONNECTED) {
+			LOG_INF("=== DISCONNECTED ===");
+			printk("\nDisconnected from Bluetooth keyboard.\n");
+			printk("Scanning for devices...\n\n");
+		}
+
+		if (events & APP_EVENT_CONNECTED) {
+			boot_phase_mark(BOOT_PHASE_CONNECTED);
+			LOG_INF("=== CONNECTED ===");
+			printk("\nConnected to Bluetooth keyboard!\n\n");
 		}
 
-		k_msleep(100);
+		if (events & APP_EVENT_HID_READY) {
+			boot_phase_mark(BOOT_PHASE_HID_READY);
+			printk("Keyboard ready, forwarding keystrokes.\n\n");
+		}
+
+		if ((events & APP_EVENT_PASSKEY) &&
+		    !(events & (APP_EVENT_PAIRING_DONE | APP_EVENT_DISCONNECTED))) {
+			status_led_set_pattern(STATUS_LED_FAST_BLINK);
+		} else if (events & (APP_EVENT_CONNECTED | APP_EVENT_DISCONNECTED |
+				     APP_EVENT_PAIRING_DONE)) {
+			/* Solid LED when connected, blink while scanning */
+			status_led_set_pattern(ble_central_is_connected() ?
+					       STATUS_LED_SOLID :
+					       STATUS_LED_SLOW_BLINK);
+		}
 	}
 
 	return 0;
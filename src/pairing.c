@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <stdlib.h>
 #include <zephyr/kernel.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
@@ -7,8 +8,24 @@
 #include <zephyr/logging/log.h>
 
 #include "pairing.h"
+#include "bond_cache.h"
+#include "app_event.h"
+#include "ble_central.h"
+#include "console.h"
 
-LOG_MODULE_REGISTER(pairing, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(pairing, CONFIG_APP_LOG_LEVEL);
+
+/*
+ * Bonds kept. The Bluetooth host has one key slot more, so a new peer
+ * can pair while the table is full; a bond is evicted only once the
+ * new one is stored, see make_room().
+ */
+#define PAIRING_MAX_BONDS (CONFIG_BT_MAX_PAIRED - 1)
+
+BUILD_ASSERT(PAIRING_MAX_BONDS >= 1,
+	     "CONFIG_BT_MAX_PAIRED must leave a key slot for pairing");
+
+static void make_room(const bt_addr_le_t *addr);
 
 /*
  * Passkey display callback
@@ -40,6 +57,8 @@ static void auth_passkey_display(struct bt_conn *conn, unsigned int passkey)
 	printk("\n");
 	printk("========================================\n");
 	printk("\n");
+
+	app_event_post(APP_EVENT_PASSKEY);
 }
 
 /*
@@ -82,6 +101,8 @@ static void auth_cancel(struct bt_conn *conn)
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 	LOG_WRN("Pairing cancelled: %s", addr);
+
+	app_event_post(APP_EVENT_PAIRING_DONE);
 }
 
 /*
@@ -105,9 +126,13 @@ static void pairing_complete(struct bt_conn *conn, bool bonded)
 		printk("Bond stored - will auto-reconnect\n");
 		printk("========================================\n");
 		printk("\n");
+
+		make_room(bt_conn_get_dst(conn));
 	} else {
 		LOG_INF("Pairing complete (not bonded): %s", addr);
 	}
+
+	app_event_post(APP_EVENT_PAIRING_DONE);
 }
 
 /*
@@ -124,6 +149,8 @@ static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
 	printk("PAIRING FAILED with %s (reason %d)\n", addr, reason);
 	printk("Please try again.\n");
 	printk("\n");
+
+	app_event_post(APP_EVENT_PAIRING_DONE);
 }
 
 /* Authentication callbacks */
@@ -172,6 +199,9 @@ static void unpair_cb(const struct bt_bond_info *info, void *user_data)
 	} else {
 		LOG_INF("Unpaired: %s", addr);
 	}
+
+	/* Drop everything learned from this peer */
+	bond_cache_delete(&info->addr);
 }
 
 int pairing_clear_bonds(void)
@@ -181,3 +211,204 @@ int pairing_clear_bonds(void)
 	LOG_INF("All bonds cleared");
 	return 0;
 }
+
+int pairing_remove_bond(const bt_addr_le_t *addr)
+{
+	char str[BT_ADDR_LE_STR_LEN];
+	int err;
+
+	bt_addr_le_to_str(addr, str, sizeof(str));
+
+	err = bt_unpair(BT_ID_DEFAULT, addr);
+	if (err) {
+		LOG_ERR("Failed to unpair %s: %d", str, err);
+		return err;
+	}
+
+	LOG_INF("Unpaired: %s", str);
+	bond_cache_delete(addr);
+	return 0;
+}
+
+static bool peer_connected(const bt_addr_le_t *addr)
+{
+	struct bt_conn *conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+
+	if (!conn) {
+		return false;
+	}
+
+	bt_conn_unref(conn);
+	return true;
+}
+
+/*
+ * Called once a new bond is stored: if that took the spare key slot,
+ * remove the least preferred bond that is not connected. Takes the place
+ * of CONFIG_BT_KEYS_OVERWRITE_OLDEST, which would evict the oldest key
+ * slot regardless of the user's priorities, and before pairing is done.
+ */
+static void make_room(const bt_addr_le_t *addr)
+{
+	struct bond_cache_entry entries[CONFIG_BT_MAX_PAIRED];
+	size_t count = bond_cache_list(entries, ARRAY_SIZE(entries));
+
+	if (count <= PAIRING_MAX_BONDS) {
+		return;
+	}
+
+	/* Least preferred first */
+	for (size_t i = count; i-- > 0;) {
+		if (bt_addr_le_eq(&entries[i].addr, addr) ||
+		    peer_connected(&entries[i].addr)) {
+			continue;
+		}
+
+		LOG_INF("Bond table full, evicting the least preferred bond");
+		pairing_remove_bond(&entries[i].addr);
+		return;
+	}
+
+	/* The next new peer cannot pair until a bond is removed */
+	LOG_WRN("Bond table full and every bond connected");
+}
+
+void pairing_print_bonds(void)
+{
+	struct bond_cache_entry entries[CONFIG_BT_MAX_PAIRED];
+	size_t count = bond_cache_list(entries, ARRAY_SIZE(entries));
+
+	printk("\nBonds (%zu of %d, reconnect order):\n", count, PAIRING_MAX_BONDS);
+
+	if (count == 0) {
+		printk("  None\n\n");
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		char addr[BT_ADDR_LE_STR_LEN];
+		size_t recent = 1;
+
+		/* Recency rank: 1 is the last device connected */
+		for (size_t j = 0; j < count; j++) {
+			recent += entries[j].meta.last_used > entries[i].meta.last_used;
+		}
+
+		bt_addr_le_to_str(&entries[i].addr, addr, sizeof(addr));
+		printk("  %zu. %s  priority %u  ", i + 1, addr,
+		       entries[i].meta.priority);
+		if (entries[i].meta.last_used) {
+			printk("recent #%zu", recent);
+		} else {
+			printk("never used");
+		}
+		printk("%s\n", peer_connected(&entries[i].addr) ? "  connected" : "");
+	}
+
+	printk("\n");
+}
+
+/* The reconnect policy depends on the bonds */
+static void restart_scan(void)
+{
+	if (!ble_central_is_connected()) {
+		ble_central_stop_scan();
+		ble_central_start_scan();
+	}
+}
+
+static void cmd_clear_bonds(void)
+{
+	printk("\n");
+	printk("========================================\n");
+	printk("  CLEAR ALL BLUETOOTH BONDS?\n");
+	printk("========================================\n");
+	printk("This will remove all paired devices.\n");
+	printk("You will need to re-pair your keyboard.\n");
+	printk("\n");
+	printk("Press 'y' to confirm, any other key to cancel: ");
+}
+
+static void cmd_clear_bonds_confirm(char *input)
+{
+	if (input[0] == 'y' || input[0] == 'Y') {
+		printk("\nClearing all Bluetooth bonds...\n");
+		pairing_clear_bonds();
+		printk("All bonds cleared. Device will scan for new keyboards.\n");
+		printk("You may need to put your keyboard in pairing mode again.\n\n");
+		restart_scan();
+	} else if (input[0] == 'n' || input[0] == 'N') {
+		printk("\nBond clearing cancelled.\n\n");
+	} else {
+		printk("\nInvalid input. Bond clearing cancelled.\n\n");
+	}
+}
+
+CONSOLE_CMD_INPUT_DEFINE(cmd_c_clear_bonds, "cC", "Clear all Bluetooth bonds",
+			 CONSOLE_INPUT_KEY, cmd_clear_bonds,
+			 cmd_clear_bonds_confirm);
+
+static void cmd_bonds(void)
+{
+	pairing_print_bonds();
+	printk("Bond (p <n> <0-%d> priority, d <n> remove, empty to cancel): ",
+	       BOND_CACHE_PRIORITY_MAX);
+}
+
+/* Apply a "p <n> <priority>" or "d <n>" line, <n> as listed by 'o' */
+static void cmd_bonds_apply(char *line)
+{
+	struct bond_cache_entry entries[CONFIG_BT_MAX_PAIRED];
+	size_t count;
+	unsigned long index;
+	unsigned long priority;
+	char *end;
+
+	if (line[0] == '\0') {
+		printk("Cancelled.\n\n");
+		return;
+	}
+
+	if ((line[0] != 'p' && line[0] != 'd') || line[1] != ' ') {
+		printk("Usage: p <n> <0-%d> or d <n>\n\n", BOND_CACHE_PRIORITY_MAX);
+		return;
+	}
+
+	count = bond_cache_list(entries, ARRAY_SIZE(entries));
+	index = strtoul(&line[2], &end, 10);
+	if (end == &line[2] || index == 0 || index > count) {
+		printk("No bond %s, see 'o'\n\n", &line[2]);
+		return;
+	}
+
+	if (line[0] == 'd') {
+		if (pairing_remove_bond(&entries[index - 1].addr) == 0) {
+			printk("Bond %lu removed.\n\n", index);
+		}
+		restart_scan();
+		return;
+	}
+
+	line = end;
+	priority = strtoul(line, &end, 10);
+	if (end == line || priority > BOND_CACHE_PRIORITY_MAX ||
+	    bond_cache_set_priority(&entries[index - 1].addr, priority)) {
+		printk("Priority must be 0 to %d\n\n", BOND_CACHE_PRIORITY_MAX);
+		return;
+	}
+
+	printk("Bond %lu priority %lu.\n", index, priority);
+	pairing_print_bonds();
+}
+
+static void cmd_pair_new(void)
+{
+	printk("\nScanning for a new keyboard, put it in pairing mode now.\n\n");
+	ble_central_pair_new();
+}
+
+CONSOLE_CMD_DEFINE(cmd_n_pair_new, "nN", "Pair a new keyboard", cmd_pair_new);
+
+CONSOLE_CMD_INPUT_DEFINE(cmd_o_bonds, "oO",
+			 "List bonds, set their priority or remove one",
+			 CONSOLE_INPUT_LINE, cmd_bonds, cmd_bonds_apply);
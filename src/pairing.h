@@ -3,6 +3,8 @@
 #ifndef PAIRING_H_
 #define PAIRING_H_
 
+#include <zephyr/bluetooth/addr.h>
+
 /**
  * Initialize pairing callbacks for passkey display
  * This sets up Bluetooth authentication callbacks for
@@ -16,4 +18,17 @@ void pairing_init(void);
  */
 int pairing_clear_bonds(void);
 
+/**
+ * Remove one bond and everything cached for it
+ * Disconnects the peer if connected
+ * @param addr Peer identity address
+ * @return 0 on success, negative error code on failure
+ */
+int pairing_remove_bond(const bt_addr_le_t *addr);
+
+/**
+ * Print the bonds, most preferred first, numbered for the console
+ */
+void pairing_print_bonds(void);
+
 #endif /* PAIRING_H_ */
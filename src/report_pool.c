@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include "report_pool.h"
+
+/*
+ * Enough buffers for a full ring plus everything held outside it: the
+ * report being filled, the one in the IN endpoint, the coalescing
+ * lookahead and one spare for a release sent while the ring is full.
+ * The USB layer also keeps the last queued report of every ID, and up
+ * to a ring's worth of merged reports while the host is not polling.
+ */
+#define REPORT_POOL_SIZE                                                       \
+	(2 * CONFIG_APP_USB_TX_RING_SIZE + 4 + APP_USB_HID_REPORT_ID_TOTAL)
+
+K_MEM_SLAB_DEFINE_STATIC(report_slab, ROUND_UP(sizeof(struct report_buf), 4),
+			 REPORT_POOL_SIZE, 4);
+
+struct report_buf *report_pool_alloc(uint8_t report_id, uint32_t timestamp)
+{
+	struct report_buf *buf;
+
+	if (k_mem_slab_alloc(&report_slab, (void **)&buf, K_NO_WAIT) != 0) {
+		return NULL;
+	}
+
+	atomic_set(&buf->ref, 1);
+	buf->timestamp = timestamp;
+	buf->flags = 0;
+	buf->data[0] = report_id;
+	buf->len = 1;
+
+	return buf;
+}
+
+struct report_buf *report_pool_ref(struct report_buf *buf)
+{
+	atomic_inc(&buf->ref);
+	return buf;
+}
+
+void report_pool_unref(struct report_buf *buf)
+{
+	if (buf && atomic_dec(&buf->ref) == 1) {
+		k_mem_slab_free(&report_slab, buf);
+	}
+}
+
+uint32_t report_pool_free_count(void)
+{
+	return k_mem_slab_num_free_get(&report_slab);
+}
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef REPORT_POOL_H_
+#define REPORT_POOL_H_
+
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "usb_hid.h"
+
+/* Buffer flags */
+/* Must be sent as is, not merged with a newer report of the same ID */
+#define REPORT_BUF_FLAG_NO_COALESCE BIT(0)
+
+/*
+ * One HID report, filled once from the BLE notification and handed by
+ * reference through the report ring to the IN endpoint. Reference
+ * counted: the ring, the endpoint and the coalescing state may each
+ * hold one.
+ */
+struct report_buf {
+	atomic_t ref;
+	/* Timestamp taken at BLE notification (see latency.h) */
+	uint32_t timestamp;
+	/* Length of data, including the report ID */
+	uint8_t len;
+	/* REPORT_BUF_FLAG_* */
+	uint8_t flags;
+	/* Release generation of the peer when queued, see usb_hid.c */
+	uint8_t gen;
+	/* Report ID followed by the report body */
+	uint8_t data[APP_USB_HID_REPORT_MAX_SIZE];
+};
+
+/**
+ * Take a buffer from the pool
+ * Never blocks, safe to call from any context. The buffer starts with
+ * one reference, the report ID in data[0] and len 1.
+ * @param report_id Report ID
+ * @param timestamp Timestamp taken when the report arrived (latency_now())
+ * @return Buffer, NULL if the pool is exhausted
+ */
+struct report_buf *report_pool_alloc(uint8_t report_id, uint32_t timestamp);
+
+/**
+ * Take an extra reference
+ * @param buf Buffer
+ * @return buf
+ */
+struct report_buf *report_pool_ref(struct report_buf *buf);
+
+/**
+ * Drop a reference, returning the buffer to the pool on the last one
+ * Safe to call from ISR context
+ * @param buf Buffer, may be NULL
+ */
+void report_pool_unref(struct report_buf *buf);
+
+/**
+ * Get the number of free buffers
+ * @return Free buffer count
+ */
+uint32_t report_pool_free_count(void);
+
+#endif /* REPORT_POOL_H_ */
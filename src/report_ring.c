@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include "report_ring.h"
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_APP_USB_TX_RING_SIZE),
+	     "CONFIG_APP_USB_TX_RING_SIZE must be a power of two");
+
+#define RING_MASK (CONFIG_APP_USB_TX_RING_SIZE - 1)
+
+void report_ring_reset(struct report_ring *ring)
+{
+	struct report_buf *buf;
+
+	while ((buf = report_ring_get(ring)) != NULL) {
+		report_pool_unref(buf);
+	}
+}
+
+int report_ring_put(struct report_ring *ring, struct report_buf *buf)
+{
+	/* Only the producer writes head */
+	atomic_val_t head = atomic_get(&ring->head);
+	atomic_val_t tail = atomic_get(&ring->tail);
+	int ret = 0;
+
+	if ((atomic_val_t)(head - tail) >= CONFIG_APP_USB_TX_RING_SIZE) {
+		struct report_buf *oldest = ring->entries[tail & RING_MASK];
+
+		if (IS_ENABLED(CONFIG_APP_USB_TX_OVERFLOW_DROP_NEWEST)) {
+			report_pool_unref(buf);
+			return -ENOBUFS;
+		}
+
+		/* Evict the oldest report. If the CAS fails the consumer
+		 * just took it, which frees the slot just the same.
+		 */
+		if (atomic_cas(&ring->tail, tail, tail + 1)) {
+			report_pool_unref(oldest);
+			ret = -EOVERFLOW;
+		}
+	}
+
+	ring->entries[head & RING_MASK] = buf;
+
+	/* Publish the slot */
+	atomic_set(&ring->head, head + 1);
+
+	return ret;
+}
+
+struct report_buf *report_ring_get(struct report_ring *ring)
+{
+	struct report_buf *buf;
+	atomic_val_t tail;
+
+	do {
+		tail = atomic_get(&ring->tail);
+		if (tail == atomic_get(&ring->head)) {
+			return NULL;
+		}
+
+		buf = ring->entries[tail & RING_MASK];
+
+		/* If the producer evicted this slot while we were reading
+		 * it, tail has moved on and the slot may hold a newer
+		 * report: retry.
+		 */
+	} while (!atomic_cas(&ring->tail, tail, tail + 1));
+
+	return buf;
+}
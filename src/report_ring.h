@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef REPORT_RING_H_
+#define REPORT_RING_H_
+
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "report_pool.h"
+
+/*
+ * Lock-free ring of report buffer references between one producer
+ * (Bluetooth RX thread) and one consumer (USB TX thread). head and tail
+ * are free-running counters; the slot index is the counter masked by
+ * the ring size. Reports are never copied, each slot owns one
+ * reference to a pool buffer.
+ */
+struct report_ring {
+	atomic_t head;
+	atomic_t tail;
+	struct report_buf *entries[CONFIG_APP_USB_TX_RING_SIZE];
+};
+
+/**
+ * Drop every queued report
+ * Consumer side, must not race with report_ring_get()
+ * @param ring Ring to empty
+ */
+void report_ring_reset(struct report_ring *ring);
+
+/**
+ * Queue a report (producer side, never blocks)
+ * Takes over the caller's reference, also when the report is dropped.
+ * @param ring Ring to queue into
+ * @param buf Report buffer
+ * @return 0 on success, -EOVERFLOW if queued by evicting the oldest report,
+ *         -ENOBUFS if the report was dropped because the ring is full
+ */
+int report_ring_put(struct report_ring *ring, struct report_buf *buf);
+
+/**
+ * Get the number of queued reports
+ * @param ring Ring to inspect
+ * @return Queued report count
+ */
+static inline uint32_t report_ring_count(struct report_ring *ring)
+{
+	return (uint32_t)(atomic_get(&ring->head) - atomic_get(&ring->tail));
+}
+
+/**
+ * Dequeue the oldest report (consumer side, never blocks)
+ * @param ring Ring to dequeue from
+ * @return Report buffer with the ring's reference, NULL if the ring is empty
+ */
+struct report_buf *report_ring_get(struct report_ring *ring);
+
+#endif /* REPORT_RING_H_ */
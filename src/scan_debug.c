@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gap.h>
+#include <zephyr/logging/log.h>
+
+#include "scan_debug.h"
+#include "console.h"
+
+LOG_MODULE_REGISTER(scan_debug, CONFIG_APP_LOG_LEVEL);
+
+#define NAME_MAX_LEN 20
+
+/* Helper to extract device name from advertising data */
+static bool parse_name(struct bt_data *data, void *user_data)
+{
+	char *name = user_data;
+	uint8_t len;
+
+	switch (data->type) {
+	case BT_DATA_NAME_SHORTENED:
+	case BT_DATA_NAME_COMPLETE:
+		len = MIN(data->data_len, NAME_MAX_LEN - 1);
+		memcpy(name, data->data, len);
+		name[len] = '\0';
+		return false; /* Stop parsing */
+	default:
+		return true; /* Continue parsing */
+	}
+}
+
+/* bt_data_parse() consumes the buffer, the scan module still needs it */
+static void get_name(struct net_buf_simple *buf, char *name)
+{
+	struct net_buf_simple_state state;
+
+	name[0] = '\0';
+	net_buf_simple_save(buf, &state);
+	bt_data_parse(buf, parse_name, name);
+	net_buf_simple_restore(buf, &state);
+}
+
+#if defined(CONFIG_APP_SCAN_DEBUG_TABLE)
+
+struct seen_device {
+	bt_addr_le_t addr;
+	char name[NAME_MAX_LEN];
+	uint32_t count;
+	uint32_t last_seen_ms;
+	int8_t rssi;
+	int8_t rssi_max;
+};
+
+static struct seen_device seen[CONFIG_APP_SCAN_DEBUG_TABLE_SIZE];
+static size_t seen_count;
+/* Entries overwritten because the table was full */
+static uint32_t evicted;
+static struct k_spinlock lock;
+
+static struct seen_device *find_slot(const bt_addr_le_t *addr)
+{
+	struct seen_device *oldest = NULL;
+
+	for (size_t i = 0; i < seen_count; i++) {
+		if (bt_addr_le_eq(&seen[i].addr, addr)) {
+			return &seen[i];
+		}
+		if (!oldest || seen[i].last_seen_ms < oldest->last_seen_ms) {
+			oldest = &seen[i];
+		}
+	}
+
+	if (seen_count < ARRAY_SIZE(seen)) {
+		return &seen[seen_count++];
+	}
+
+	/* Table full: reuse the least recently seen entry */
+	evicted++;
+	return oldest;
+}
+
+static void scan_recv_cb(const struct bt_le_scan_recv_info *info,
+			 struct net_buf_simple *buf)
+{
+	struct seen_device *dev;
+	k_spinlock_key_t key;
+
+	if (!(info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE)) {
+		return;
+	}
+
+	key = k_spin_lock(&lock);
+
+	dev = find_slot(info->addr);
+	if (!bt_addr_le_eq(&dev->addr, info->addr) || dev->count == 0) {
+		memset(dev, 0, sizeof(*dev));
+		bt_addr_le_copy(&dev->addr, info->addr);
+		dev->rssi_max = INT8_MIN;
+	}
+
+	/* Names usually come in the scan response, keep looking until found */
+	if (dev->name[0] == '\0') {
+		get_name(buf, dev->name);
+	}
+
+	dev->count++;
+	dev->last_seen_ms = k_uptime_get_32();
+	dev->rssi = info->rssi;
+	dev->rssi_max = MAX(dev->rssi_max, info->rssi);
+
+	k_spin_unlock(&lock, key);
+}
+
+void scan_debug_print(void)
+{
+	struct seen_device dev;
+	uint32_t now = k_uptime_get_32();
+	size_t count;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&lock);
+	count = seen_count;
+	k_spin_unlock(&lock, key);
+
+	printk("\nSeen devices (%zu/%u, %u evictions):\n", count,
+	       CONFIG_APP_SCAN_DEBUG_TABLE_SIZE, evicted);
+	printk("  %-30s %-19s  rssi  max  count   age(s)\n", "address", "name");
+
+	for (size_t i = 0; i < count; i++) {
+		char addr[BT_ADDR_LE_STR_LEN];
+
+		/* Copy out so printing does not hold up the RX thread */
+		key = k_spin_lock(&lock);
+		dev = seen[i];
+		k_spin_unlock(&lock, key);
+
+		bt_addr_le_to_str(&dev.addr, addr, sizeof(addr));
+		printk("  %-30s %-19s %5d %4d %6u %8u\n", addr,
+		       dev.name[0] ? dev.name : "-", dev.rssi, dev.rssi_max,
+		       dev.count, (now - dev.last_seen_ms) / MSEC_PER_SEC);
+	}
+
+	printk("\n");
+}
+
+void scan_debug_reset(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	seen_count = 0;
+	evicted = 0;
+	memset(seen, 0, sizeof(seen));
+
+	k_spin_unlock(&lock, key);
+}
+
+static void cmd_reset(void)
+{
+	scan_debug_reset();
+	printk("\nSeen device table cleared.\n\n");
+}
+
+CONSOLE_CMD_DEFINE(cmd_d_scan_table, "d", "Show seen BLE devices (D to clear)",
+		   scan_debug_print);
+CONSOLE_CMD_DEFINE(cmd_d_scan_table_reset, "D", NULL, cmd_reset);
+
+#else /* CONFIG_APP_SCAN_DEBUG_PRINT */
+
+static void scan_recv_cb(const struct bt_le_scan_recv_info *info,
+			 struct net_buf_simple *buf)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+	char name[NAME_MAX_LEN];
+
+	/* Only show connectable devices */
+	if (!(info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE)) {
+		return;
+	}
+
+	/* Only print nearby devices with names (to reduce spam) */
+	if (info->rssi <= -80) {
+		return;
+	}
+
+	get_name(buf, name);
+	if (name[0] == '\0') {
+		return;
+	}
+
+	bt_addr_le_to_str(info->addr, addr, sizeof(addr));
+	printk("[DEBUG] BLE device: \"%s\" [%s] RSSI %d\n", name, addr, info->rssi);
+}
+
+void scan_debug_print(void)
+{
+	printk("\nSeen device table needs CONFIG_APP_SCAN_DEBUG_TABLE\n\n");
+}
+
+void scan_debug_reset(void)
+{
+}
+
+#endif /* CONFIG_APP_SCAN_DEBUG_TABLE */
+
+static struct bt_le_scan_cb scan_debug_cb = {
+	.recv = scan_recv_cb,
+};
+
+void scan_debug_init(void)
+{
+	bt_le_scan_cb_register(&scan_debug_cb);
+
+	if (IS_ENABLED(CONFIG_APP_SCAN_DEBUG_TABLE)) {
+		LOG_INF("Scan debug: recording up to %u devices",
+			CONFIG_APP_SCAN_DEBUG_TABLE_SIZE);
+	} else {
+		LOG_INF("Scan debug: printing all connectable devices");
+	}
+}
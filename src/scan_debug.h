@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef SCAN_DEBUG_H_
+#define SCAN_DEBUG_H_
+
+/*
+ * Scan diagnostics: reports every connectable advertiser, not just the
+ * HID devices matched by the scan filter. Compiled out unless
+ * CONFIG_APP_SCAN_DEBUG_PRINT or CONFIG_APP_SCAN_DEBUG_TABLE is set.
+ */
+
+#if defined(CONFIG_APP_SCAN_DEBUG)
+
+/**
+ * Register the scan callback
+ * Call after Bluetooth is enabled
+ */
+void scan_debug_init(void);
+
+/**
+ * Print the table of seen devices on the console
+ * Only has data with CONFIG_APP_SCAN_DEBUG_TABLE
+ */
+void scan_debug_print(void);
+
+/**
+ * Forget all seen devices
+ */
+void scan_debug_reset(void);
+
+#else
+
+static inline void scan_debug_init(void) {}
+static inline void scan_debug_print(void) {}
+static inline void scan_debug_reset(void) {}
+
+#endif /* CONFIG_APP_SCAN_DEBUG */
+
+#endif /* SCAN_DEBUG_H_ */
@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/pwm.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+
+#include "status_led.h"
+
+LOG_MODULE_REGISTER(status_led, CONFIG_APP_LOG_LEVEL);
+
+/* LED sampling period, also the length of an activity flicker */
+#define TICK_MS 20
+
+/* Blink half-periods in ticks */
+#define SLOW_BLINK_TICKS (1000 / TICK_MS)
+#define FAST_BLINK_TICKS (100 / TICK_MS)
+
+/* Output levels, in percent of full brightness */
+#define LEVEL_OFF      0
+#define LEVEL_ON       100
+#define LEVEL_ACTIVITY 20
+
+#if defined(CONFIG_APP_STATUS_LED_PWM)
+static const struct pwm_dt_spec led = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led0));
+#else
+/* Built-in LED on XIAO */
+static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET_OR(DT_ALIAS(led0), gpios, {0});
+#endif
+
+static atomic_t activity;
+static atomic_t pattern = ATOMIC_INIT(STATUS_LED_SLOW_BLINK);
+/* Timer started, set before k_timer_start() and cleared after the stop */
+static atomic_t running;
+/* LED off and timer kept stopped while the bridge is idle */
+static atomic_t dark;
+/* Level last written, -1 forces the next write */
+static int level = -1;
+static bool ready;
+
+static void led_set(uint8_t level)
+{
+#if defined(CONFIG_APP_STATUS_LED_PWM)
+	pwm_set_pulse_dt(&led, (uint64_t)led.period * level / 100);
+#else
+	/* No dimming: an activity flicker turns the LED off */
+	gpio_pin_set_dt(&led, level == LEVEL_ON);
+#endif
+}
+
+static uint8_t pattern_level(enum status_led_pattern p, uint32_t tick)
+{
+	switch (p) {
+	case STATUS_LED_SLOW_BLINK:
+		return (tick / SLOW_BLINK_TICKS) & 1 ? LEVEL_OFF : LEVEL_ON;
+	case STATUS_LED_FAST_BLINK:
+		return (tick / FAST_BLINK_TICKS) & 1 ? LEVEL_OFF : LEVEL_ON;
+	case STATUS_LED_SOLID:
+	default:
+		return LEVEL_ON;
+	}
+}
+
+static void tick_handler(struct k_timer *timer);
+
+static K_TIMER_DEFINE(tick_timer, tick_handler, NULL);
+
+/* Start the timer unless it runs already; safe from any context */
+static void timer_kick(void)
+{
+	if (!ready || atomic_get(&dark)) {
+		return;
+	}
+
+	if (atomic_cas(&running, 0, 1)) {
+		k_timer_start(&tick_timer, K_NO_WAIT, K_MSEC(TICK_MS));
+	}
+}
+
+/*
+ * Runs every TICK_MS while needed: reports forwarded since the previous
+ * tick make the LED flicker for one tick, however many there were. The
+ * LED is only written when its level changes. A solid LED without
+ * traffic needs no ticks, so the timer stops once the level is steady
+ * and is started again by the next report or pattern change.
+ */
+static void tick_handler(struct k_timer *timer)
+{
+	static atomic_val_t seen;
+	static uint32_t tick;
+	atomic_val_t count = atomic_get(&activity);
+	enum status_led_pattern p = atomic_get(&pattern);
+	uint8_t next;
+
+	if (atomic_get(&dark)) {
+		k_timer_stop(timer);
+		atomic_clear(&running);
+		return;
+	}
+
+	next = pattern_level(p, tick++);
+	if (count != seen && next == LEVEL_ON) {
+		next = LEVEL_ACTIVITY;
+	}
+	seen = count;
+
+	if (next != level) {
+		level = next;
+		led_set(next);
+	}
+
+	/* Keep ticking through a blink, or to end an activity flicker */
+	if (p != STATUS_LED_SOLID || next != LEVEL_ON) {
+		return;
+	}
+
+	k_timer_stop(timer);
+	atomic_clear(&running);
+
+	/* A report or pattern change racing the stop */
+	if (atomic_get(&activity) != seen ||
+	    atomic_get(&pattern) != STATUS_LED_SOLID) {
+		timer_kick();
+	}
+}
+
+int status_led_init(void)
+{
+#if defined(CONFIG_APP_STATUS_LED_PWM)
+	if (!pwm_is_ready_dt(&led)) {
+		LOG_WRN("Status LED PWM not ready");
+		return -ENODEV;
+	}
+#else
+	if (!led.port) {
+		return -ENODEV;
+	}
+
+	if (!device_is_ready(led.port)) {
+		LOG_WRN("Status LED GPIO not ready");
+		return -ENODEV;
+	}
+
+	int err = gpio_pin_configure_dt(&led, GPIO_OUTPUT_INACTIVE);
+
+	if (err) {
+		LOG_WRN("Failed to configure LED: %d", err);
+		return err;
+	}
+#endif
+
+	ready = true;
+	timer_kick();
+	LOG_INF("Status LED configured (%s)",
+		IS_ENABLED(CONFIG_APP_STATUS_LED_PWM) ? "PWM" : "GPIO");
+
+	return 0;
+}
+
+void status_led_set_pattern(enum status_led_pattern p)
+{
+	atomic_set(&pattern, p);
+	timer_kick();
+}
+
+void status_led_activity(void)
+{
+	atomic_inc(&activity);
+	timer_kick();
+}
+
+void status_led_set_idle(bool idle)
+{
+	if (!ready) {
+		return;
+	}
+
+	if (idle) {
+		atomic_set(&dark, 1);
+		k_timer_stop(&tick_timer);
+		atomic_clear(&running);
+		led_set(LEVEL_OFF);
+		level = -1;
+	} else {
+		atomic_clear(&dark);
+		timer_kick();
+	}
+}
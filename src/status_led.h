@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef STATUS_LED_H_
+#define STATUS_LED_H_
+
+#include <stdbool.h>
+
+/* Base pattern of the status LED */
+enum status_led_pattern {
+	/* Connected */
+	STATUS_LED_SOLID,
+	/* Scanning */
+	STATUS_LED_SLOW_BLINK,
+	/* Waiting for the passkey to be typed */
+	STATUS_LED_FAST_BLINK,
+};
+
+/**
+ * Configure the LED and show the current pattern
+ * @return 0 on success, negative error code on failure
+ */
+int status_led_init(void);
+
+/**
+ * Select the base pattern
+ * @param pattern Pattern to show
+ */
+void status_led_set_pattern(enum status_led_pattern pattern);
+
+/**
+ * Count one forwarded report
+ * Increments a counter and starts the sampling timer if it is stopped,
+ * the LED flickers on the next tick.
+ * Safe to call from any context.
+ */
+void status_led_activity(void);
+
+/**
+ * Turn the LED off and stop its timer while the bridge is idle
+ * The pattern and activity are still tracked, and shown again on wake.
+ * Call from thread context.
+ * @param idle true to turn the LED off, false to resume
+ */
+void status_led_set_idle(bool idle);
+
+#endif /* STATUS_LED_H_ */
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/iterable_sections.h>
+#include <zephyr/sys/sys_heap.h>
+#include <zephyr/net/buf.h>
+
+#include "sys_stats.h"
+#include "report_pool.h"
+#include "console.h"
+
+#if CONFIG_HEAP_MEM_POOL_SIZE > 0
+/* System heap behind k_malloc(), defined by the kernel */
+extern struct k_heap _system_heap;
+#endif
+
+/* Up to this many threads get a CPU share since the previous print */
+#define MAX_THREADS 16
+
+struct thread_sample {
+	const struct k_thread *thread;
+	uint64_t cycles;
+};
+
+static struct thread_sample prev_threads[MAX_THREADS];
+
+static uint64_t prev_total;
+static uint64_t prev_idle;
+
+static uint64_t prev_cycles(const struct k_thread *thread)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(prev_threads); i++) {
+		if (prev_threads[i].thread == thread) {
+			return prev_threads[i].cycles;
+		}
+	}
+
+	return 0;
+}
+
+struct thread_walk {
+	uint64_t total;
+	size_t count;
+	/* Snapshot taken during this print, becomes prev_threads */
+	struct thread_sample next[MAX_THREADS];
+};
+
+static void print_thread(const struct k_thread *cthread, void *user_data)
+{
+	struct k_thread *thread = (struct k_thread *)cthread;
+	struct thread_walk *walk = user_data;
+	k_thread_runtime_stats_t rt;
+	const char *name = k_thread_name_get(thread);
+	size_t size = thread->stack_info.size;
+	size_t unused = 0;
+	uint64_t cycles = 0;
+	uint32_t permille = 0;
+
+	if (k_thread_stack_space_get(thread, &unused) != 0) {
+		unused = 0;
+	}
+
+	if (k_thread_runtime_stats_get(thread, &rt) == 0) {
+		cycles = rt.execution_cycles;
+		if (walk->total) {
+			permille = (cycles - prev_cycles(thread)) * 1000 / walk->total;
+		}
+	}
+
+	if (walk->count < ARRAY_SIZE(walk->next)) {
+		walk->next[walk->count].thread = thread;
+		walk->next[walk->count].cycles = cycles;
+	}
+	walk->count++;
+
+	printk("  %-20s %4d %5zu %5zu %3u%% %3u.%u%%\n",
+	       name && name[0] ? name : "?", thread->base.prio, size,
+	       size - unused, size ? (uint32_t)((size - unused) * 100 / size) : 0,
+	       permille / 10, permille % 10);
+}
+
+static void print_threads(void)
+{
+	static struct thread_walk walk;
+	k_thread_runtime_stats_t all;
+	uint64_t total = 0;
+	uint64_t idle = 0;
+
+	if (k_thread_runtime_stats_all_get(&all) == 0) {
+		total = all.execution_cycles - prev_total;
+		idle = all.idle_cycles - prev_idle;
+		prev_total = all.execution_cycles;
+		prev_idle = all.idle_cycles;
+	}
+
+	walk.total = total;
+	walk.count = 0;
+
+	printk("\nThreads               prio  stack  used       cpu\n");
+	/* Unlocked: printing with the scheduler locked would stall the BT stack */
+	k_thread_foreach_unlocked(print_thread, &walk);
+
+	memcpy(prev_threads, walk.next, sizeof(prev_threads));
+
+	if (total) {
+		uint32_t load = (total - MIN(idle, total)) * 1000 / total;
+
+		printk("  CPU load %u.%u%% over %llu ms\n", load / 10, load % 10,
+		       k_cyc_to_ms_floor64(total));
+	}
+}
+
+static void print_heap(void)
+{
+#if CONFIG_HEAP_MEM_POOL_SIZE > 0
+	struct sys_memory_stats stats;
+
+	if (sys_heap_runtime_stats_get(&_system_heap.heap, &stats) == 0) {
+		printk("\nHeap: %zu used, %zu peak, %zu free of %u bytes\n",
+		       stats.allocated_bytes, stats.max_allocated_bytes,
+		       stats.free_bytes, CONFIG_HEAP_MEM_POOL_SIZE);
+	}
+#else
+	printk("\nHeap: none\n");
+#endif
+}
+
+static void print_pools(void)
+{
+	printk("\nBuffer pools          free  size\n");
+
+	STRUCT_SECTION_FOREACH(net_buf_pool, pool) {
+		printk("  %-20s %4d %5u\n", pool->name ? pool->name : "?",
+		       atomic_get(&pool->avail_count), pool->buf_count);
+	}
+
+	printk("  %-20s %4u\n", "report_pool", report_pool_free_count());
+}
+
+void sys_stats_print(void)
+{
+	print_threads();
+	print_heap();
+	print_pools();
+	printk("\n");
+}
+
+CONSOLE_CMD_DEFINE(cmd_s_sys_stats, "sS",
+		   "Show threads, stacks, heap, buffers and CPU load",
+		   sys_stats_print);
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef SYS_STATS_H_
+#define SYS_STATS_H_
+
+/*
+ * Runtime footprint: thread stack high-water marks and CPU usage, heap
+ * and buffer pool usage. Compiled out unless CONFIG_APP_SYS_STATS is set.
+ */
+
+#if defined(CONFIG_APP_SYS_STATS)
+
+/**
+ * Print threads, heap, buffer pools and CPU load on the console
+ * CPU figures cover the time since the previous call (boot on the first)
+ */
+void sys_stats_print(void);
+
+#else
+
+static inline void sys_stats_print(void) {}
+
+#endif /* CONFIG_APP_SYS_STATS */
+
+#endif /* SYS_STATS_H_ */
@@ -0,0 +1,253 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+
+#if defined(CONFIG_APP_TRACE_FAULT_SAVE)
+#include <zephyr/fatal.h>
+#include <zephyr/logging/log_ctrl.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/reboot.h>
+#endif
+
+#include "trace.h"
+#include "console.h"
+
+LOG_MODULE_REGISTER(trace, CONFIG_APP_LOG_LEVEL);
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_APP_TRACE_RECORDS),
+	     "CONFIG_APP_TRACE_RECORDS must be a power of two");
+
+#define TRACE_MASK (CONFIG_APP_TRACE_RECORDS - 1)
+
+/* ring.magic: the ring holds the trace of a fatal error */
+#define TRACE_FAULT_MAGIC 0x46435254
+#define TRACE_FAULT_KEY "trace/fault"
+
+/*
+ * head is a free-running counter, the slot is head masked by the ring
+ * size. This is also the layout saved to flash.
+ */
+struct trace_log {
+	atomic_t head;
+	struct trace_rec recs[CONFIG_APP_TRACE_RECORDS];
+};
+
+/* Not cleared at boot: a fatal error hands the ring over the reset */
+static __noinit struct {
+	uint32_t magic;
+	struct trace_log log;
+} ring;
+
+/* Until trace_init() is done, and while the ring is printed */
+static atomic_t paused = ATOMIC_INIT(1);
+
+static const char *const event_names[TRACE_EV_COUNT] = {
+	[TRACE_EV_NOTIFY] = "notify",
+	[TRACE_EV_ENQUEUE] = "enqueue",
+	[TRACE_EV_WRITE] = "write",
+	[TRACE_EV_COMPLETE] = "complete",
+	[TRACE_EV_RELEASE] = "release",
+	[TRACE_EV_STALE] = "stale",
+	[TRACE_EV_DISCONNECT] = "disconnect",
+	[TRACE_EV_HOST_STALL] = "host stall",
+	[TRACE_EV_FAULT] = "FAULT",
+};
+
+void trace_record(enum trace_event event, uint8_t source, uint8_t report_id,
+		  uint8_t arg, const uint8_t *data, uint8_t len)
+{
+	struct trace_rec *rec;
+
+	if (atomic_get(&paused)) {
+		return;
+	}
+
+	rec = &ring.log.recs[atomic_inc(&ring.log.head) & TRACE_MASK];
+	rec->time = k_cycle_get_32();
+	rec->event = event;
+	rec->source = source;
+	rec->report_id = report_id;
+	rec->arg = arg;
+
+	len = data ? MIN(len, TRACE_DATA_LEN) : 0;
+	if (len) {
+		memcpy(rec->data, data, len);
+	}
+	memset(&rec->data[len], 0, TRACE_DATA_LEN - len);
+}
+
+/* Oldest first, times relative to the newest record */
+static void print_log(const struct trace_log *log)
+{
+	uint32_t head = log->head;
+	uint32_t count = MIN(head, CONFIG_APP_TRACE_RECORDS);
+	uint32_t newest;
+
+	if (count == 0) {
+		printk("  (empty)\n\n");
+		return;
+	}
+
+	newest = log->recs[(head - 1) & TRACE_MASK].time;
+
+	printk("  %11s  %-3s %-10s %3s %3s  data\n", "ms", "src", "event", "id", "arg");
+
+	for (uint32_t i = head - count; i != head; i++) {
+		const struct trace_rec *rec = &log->recs[i & TRACE_MASK];
+		uint32_t age_us = k_cyc_to_us_floor32(newest - rec->time);
+
+		printk("  -%6u.%03u  ", age_us / 1000, age_us % 1000);
+		if (rec->source == TRACE_SOURCE_NONE) {
+			printk("%-3s ", "-");
+		} else {
+			printk("%-3u ", rec->source);
+		}
+		printk("%-10s %3u %3u ",
+		       rec->event < TRACE_EV_COUNT ? event_names[rec->event] : "?",
+		       rec->report_id, rec->arg);
+		for (int j = 0; j < TRACE_DATA_LEN; j++) {
+			printk(" %02x", rec->data[j]);
+		}
+		printk("\n");
+	}
+
+	printk("\n");
+}
+
+void trace_print(void)
+{
+	/* Leave a pause of trace_init() alone */
+	bool paused_here = atomic_cas(&paused, 0, 1);
+
+	printk("\nKey trace, last %u events:\n", CONFIG_APP_TRACE_RECORDS);
+	print_log(&ring.log);
+
+	if (paused_here) {
+		atomic_clear(&paused);
+	}
+}
+
+static void start(void)
+{
+	memset(&ring, 0, sizeof(ring));
+	atomic_clear(&paused);
+}
+
+#if defined(CONFIG_APP_TRACE_FAULT_SAVE)
+/* Loaded for printing only */
+static struct trace_log fault_log;
+
+struct load_ctx {
+	int ret;
+};
+
+static int load_cb(const char *key, size_t len, settings_read_cb read_cb,
+		   void *cb_arg, void *param)
+{
+	struct load_ctx *ctx = param;
+
+	/* Only the exact key, not anything below it */
+	if (key != NULL) {
+		return 0;
+	}
+
+	if (len != sizeof(fault_log)) {
+		/* Saved by a build with another ring size */
+		ctx->ret = -EINVAL;
+		return 0;
+	}
+
+	ctx->ret = read_cb(cb_arg, &fault_log, len);
+	return 0;
+}
+
+void trace_print_fault(void)
+{
+	struct load_ctx ctx = { .ret = -ENOENT };
+	int err;
+
+	err = settings_subsys_init();
+	if (!err) {
+		err = settings_load_subtree_direct(TRACE_FAULT_KEY, load_cb, &ctx);
+	}
+	if (!err) {
+		err = ctx.ret < 0 ? ctx.ret : 0;
+	}
+
+	if (err == -ENOENT) {
+		printk("\nNo fault trace saved.\n\n");
+		return;
+	} else if (err) {
+		printk("\nFault trace unreadable: %d\n\n", err);
+		return;
+	}
+
+	printk("\nKey trace before the last fatal error:\n");
+	print_log(&fault_log);
+}
+
+static void save_handler(struct k_work *work)
+{
+	int err;
+
+	ARG_UNUSED(work);
+
+	err = settings_subsys_init();
+	if (!err) {
+		err = settings_save_one(TRACE_FAULT_KEY, &ring.log, sizeof(ring.log));
+	}
+
+	if (err) {
+		LOG_ERR("Failed to save fault trace: %d", err);
+	} else {
+		LOG_WRN("Fatal error before this boot, trace saved ('K' shows it)");
+	}
+
+	start();
+}
+
+static K_WORK_DEFINE(save_work, save_handler);
+
+/*
+ * Replaces the default handler: seal the ring and reset. RAM is kept
+ * over the reset, trace_init() finds the magic and saves the ring.
+ */
+void k_sys_fatal_error_handler(unsigned int reason, const z_arch_esf_t *esf)
+{
+	ARG_UNUSED(esf);
+
+	trace_record(TRACE_EV_FAULT, TRACE_SOURCE_NONE, 0, reason, NULL, 0);
+	atomic_set(&paused, 1);
+	ring.magic = TRACE_FAULT_MAGIC;
+
+	LOG_PANIC();
+	sys_reboot(SYS_REBOOT_COLD);
+}
+#else
+void trace_print_fault(void)
+{
+	printk("\nFault traces are not saved (CONFIG_APP_TRACE_FAULT_SAVE).\n\n");
+}
+#endif /* CONFIG_APP_TRACE_FAULT_SAVE */
+
+void trace_init(void)
+{
+#if defined(CONFIG_APP_TRACE_FAULT_SAVE)
+	if (ring.magic == TRACE_FAULT_MAGIC) {
+		/* Flash writes take a while, keep them off the boot path */
+		k_work_submit(&save_work);
+		return;
+	}
+#endif
+
+	start();
+}
+
+CONSOLE_CMD_DEFINE(cmd_k_trace, "k",
+		   "Show recent key events (K: trace before last fault)",
+		   trace_print);
+CONSOLE_CMD_DEFINE(cmd_k_trace_fault, "K", NULL, trace_print_fault);
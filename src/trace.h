@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/toolchain.h>
+
+/*
+ * Key event timeline: what the bridge received, queued and sent, as
+ * 16-byte records in a RAM ring that always holds the latest
+ * CONFIG_APP_TRACE_RECORDS events. Dumped with 'k'. With
+ * CONFIG_APP_TRACE_FAULT_SAVE the ring survives a fatal error and is
+ * saved to flash on the next boot ('K'). Compiled out unless
+ * CONFIG_APP_TRACE is set.
+ */
+
+enum trace_event {
+	/* BLE input report: BLE report ID, arg = length, report bytes */
+	TRACE_EV_NOTIFY,
+	/* Offered to the USB queue: arg = errno (0: queued), report body */
+	TRACE_EV_ENQUEUE,
+	/* Written to the IN endpoint: arg = errno (0: written), report body */
+	TRACE_EV_WRITE,
+	/* IN transfer completed */
+	TRACE_EV_COMPLETE,
+	/* Empty report written to release the peer's keys */
+	TRACE_EV_RELEASE,
+	/* Queued before the peer's keys were released, discarded */
+	TRACE_EV_STALE,
+	/* Peer disconnected: arg = HCI reason */
+	TRACE_EV_DISCONNECT,
+	/* IN transfer outlived the TX timeout: host not polling */
+	TRACE_EV_HOST_STALL,
+	/* Fatal error: arg = reason (K_ERR_*), last record before the reset */
+	TRACE_EV_FAULT,
+	TRACE_EV_COUNT,
+};
+
+/* Source of events not tied to a peer */
+#define TRACE_SOURCE_NONE 0xFF
+
+/* Report bytes kept per record */
+#define TRACE_DATA_LEN 8
+
+struct trace_rec {
+	/* k_cycle_get_32() */
+	uint32_t time;
+	uint8_t event;
+	/* Peer index or TRACE_SOURCE_NONE */
+	uint8_t source;
+	/* BLE report ID for TRACE_EV_NOTIFY, USB report ID otherwise */
+	uint8_t report_id;
+	/* Event specific, see enum trace_event */
+	uint8_t arg;
+	/* Start of the report: the whole boot keyboard report, modifiers
+	 * and the first 48 usages of NKRO. Key changes show against the
+	 * previous record of the same report ID.
+	 */
+	uint8_t data[TRACE_DATA_LEN];
+};
+
+BUILD_ASSERT(sizeof(struct trace_rec) == 16, "Trace records are 16 bytes");
+
+#if defined(CONFIG_APP_TRACE)
+
+/**
+ * Take over a trace left by a fatal error, start recording
+ * Call once at boot, before the first event. A fault trace is saved to
+ * flash from the system workqueue; recording starts once it is.
+ */
+void trace_init(void);
+
+/**
+ * Record one event
+ * Lock free, safe to call from any context, no formatting.
+ * @param event Event
+ * @param source Peer index or TRACE_SOURCE_NONE
+ * @param report_id Report ID
+ * @param arg Event specific value
+ * @param data Report bytes, may be NULL
+ * @param len Length of data, only the first TRACE_DATA_LEN bytes are kept
+ */
+void trace_record(enum trace_event event, uint8_t source, uint8_t report_id,
+		  uint8_t arg, const uint8_t *data, uint8_t len);
+
+/**
+ * Print the ring on the console, oldest first
+ * Recording pauses while printing.
+ */
+void trace_print(void);
+
+/**
+ * Print the trace saved after the last fatal error
+ * Without CONFIG_APP_TRACE_FAULT_SAVE there is none.
+ */
+void trace_print_fault(void);
+
+#else
+
+static inline void trace_init(void) {}
+static inline void trace_record(enum trace_event event, uint8_t source,
+				uint8_t report_id, uint8_t arg,
+				const uint8_t *data, uint8_t len) {}
+static inline void trace_print(void) {}
+static inline void trace_print_fault(void) {}
+
+#endif /* CONFIG_APP_TRACE */
+
+#endif /* TRACE_H_ */
@@ -1,23 +1,44 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/class/usb_hid.h>
 #include <zephyr/logging/log.h>
 
 #include "usb_hid.h"
+#include "report_pool.h"
+#include "report_ring.h"
+#include "latency.h"
+#include "bond_cache.h"
+#include "log_ctl.h"
+#include "app_event.h"
+#include "app_stats.h"
+#include "trace.h"
+#include "bench.h"
 
-LOG_MODULE_REGISTER(app_usb_hid, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(app_usb_hid, CONFIG_APP_LOG_LEVEL);
 
-/* Boot keyboard HID report descriptor */
-static const uint8_t hid_report_desc[] = {
+/*
+ * Composite HID report descriptor of one peripheral
+ * Report ID 1: boot-compatible keyboard (6KRO) with LED output report
+ * Report ID 2: consumer control (6 x 16-bit usages)
+ * Report ID 3: mouse (5 buttons, 16-bit X/Y, wheel, horizontal pan)
+ * Report ID 4: NKRO keyboard bitmap (usages 0x00-0xDF)
+ * Repeated for every peripheral with its report IDs offset, see
+ * APP_USB_HID_REPORT_ID().
+ */
+static const uint8_t peer_report_desc[] = {
 	/* Usage Page (Generic Desktop) */
 	0x05, 0x01,
 	/* Usage (Keyboard) */
 	0x09, 0x06,
 	/* Collection (Application) */
 	0xA1, 0x01,
+	/* Report ID (1) */
+	0x85, APP_USB_HID_REPORT_ID_KEYBOARD,
 
 	/* Modifier keys (8 bits) */
 	/* Usage Page (Key Codes) */
@@ -83,21 +104,451 @@ static const uint8_t hid_report_desc[] = {
 	/* Input (Data, Array) */
 	0x81, 0x00,
 
+	/* End Collection */
+	0xC0,
+
+	/* Usage Page (Consumer) */
+	0x05, 0x0C,
+	/* Usage (Consumer Control) */
+	0x09, 0x01,
+	/* Collection (Application) */
+	0xA1, 0x01,
+	/* Report ID (2) */
+	0x85, APP_USB_HID_REPORT_ID_CONSUMER,
+	/* Usage Minimum (0) */
+	0x19, 0x00,
+	/* Usage Maximum (0x0FFF) */
+	0x2A, 0xFF, 0x0F,
+	/* Logical Minimum (0) */
+	0x15, 0x00,
+	/* Logical Maximum (0x0FFF) */
+	0x26, 0xFF, 0x0F,
+	/* Report Size (16) */
+	0x75, 0x10,
+	/* Report Count (6) */
+	0x95, 0x06,
+	/* Input (Data, Array, Absolute) */
+	0x81, 0x00,
+	/* End Collection */
+	0xC0,
+
+	/* Usage Page (Generic Desktop) */
+	0x05, 0x01,
+	/* Usage (Mouse) */
+	0x09, 0x02,
+	/* Collection (Application) */
+	0xA1, 0x01,
+	/* Report ID (3) */
+	0x85, APP_USB_HID_REPORT_ID_MOUSE,
+	/* Usage (Pointer) */
+	0x09, 0x01,
+	/* Collection (Physical) */
+	0xA1, 0x00,
+
+	/* Buttons (5 bits + 3 bits padding) */
+	/* Usage Page (Button) */
+	0x05, 0x09,
+	/* Usage Minimum (Button 1) */
+	0x19, 0x01,
+	/* Usage Maximum (Button 5) */
+	0x29, 0x05,
+	/* Logical Minimum (0) */
+	0x15, 0x00,
+	/* Logical Maximum (1) */
+	0x25, 0x01,
+	/* Report Count (5) */
+	0x95, 0x05,
+	/* Report Size (1) */
+	0x75, 0x01,
+	/* Input (Data, Variable, Absolute) */
+	0x81, 0x02,
+	/* Report Count (1) */
+	0x95, 0x01,
+	/* Report Size (3) */
+	0x75, 0x03,
+	/* Input (Constant) */
+	0x81, 0x01,
+
+	/* X, Y (16-bit relative) */
+	/* Usage Page (Generic Desktop) */
+	0x05, 0x01,
+	/* Usage (X) */
+	0x09, 0x30,
+	/* Usage (Y) */
+	0x09, 0x31,
+	/* Logical Minimum (-32767) */
+	0x16, 0x01, 0x80,
+	/* Logical Maximum (32767) */
+	0x26, 0xFF, 0x7F,
+	/* Report Size (16) */
+	0x75, 0x10,
+	/* Report Count (2) */
+	0x95, 0x02,
+	/* Input (Data, Variable, Relative) */
+	0x81, 0x06,
+
+	/* Wheel (8-bit relative) */
+	/* Usage (Wheel) */
+	0x09, 0x38,
+	/* Logical Minimum (-127) */
+	0x15, 0x81,
+	/* Logical Maximum (127) */
+	0x25, 0x7F,
+	/* Report Size (8) */
+	0x75, 0x08,
+	/* Report Count (1) */
+	0x95, 0x01,
+	/* Input (Data, Variable, Relative) */
+	0x81, 0x06,
+
+	/* Horizontal pan (8-bit relative) */
+	/* Usage Page (Consumer) */
+	0x05, 0x0C,
+	/* Usage (AC Pan) */
+	0x0A, 0x38, 0x02,
+	/* Logical Minimum (-127) */
+	0x15, 0x81,
+	/* Logical Maximum (127) */
+	0x25, 0x7F,
+	/* Report Size (8) */
+	0x75, 0x08,
+	/* Report Count (1) */
+	0x95, 0x01,
+	/* Input (Data, Variable, Relative) */
+	0x81, 0x06,
+
+	/* End Collection (Physical) */
+	0xC0,
+	/* End Collection (Application) */
+	0xC0,
+
+	/* Usage Page (Generic Desktop) */
+	0x05, 0x01,
+	/* Usage (Keyboard) */
+	0x09, 0x06,
+	/* Collection (Application) */
+	0xA1, 0x01,
+	/* Report ID (4) */
+	0x85, APP_USB_HID_REPORT_ID_NKRO,
+
+	/* Modifier keys (8 bits) */
+	/* Usage Page (Key Codes) */
+	0x05, 0x07,
+	/* Usage Minimum (Left Control) */
+	0x19, 0xE0,
+	/* Usage Maximum (Right GUI) */
+	0x29, 0xE7,
+	/* Logical Minimum (0) */
+	0x15, 0x00,
+	/* Logical Maximum (1) */
+	0x25, 0x01,
+	/* Report Size (1) */
+	0x75, 0x01,
+	/* Report Count (8) */
+	0x95, 0x08,
+	/* Input (Data, Variable, Absolute) */
+	0x81, 0x02,
+
+	/* Reserved byte */
+	/* Report Count (1) */
+	0x95, 0x01,
+	/* Report Size (8) */
+	0x75, 0x08,
+	/* Input (Constant) */
+	0x81, 0x01,
+
+	/* Key bitmap (one bit per usage) */
+	/* Usage Page (Key Codes) */
+	0x05, 0x07,
+	/* Usage Minimum (0) */
+	0x19, 0x00,
+	/* Usage Maximum (0xDF) */
+	0x29, 0xDF,
+	/* Logical Minimum (0) */
+	0x15, 0x00,
+	/* Logical Maximum (1) */
+	0x25, 0x01,
+	/* Report Size (1) */
+	0x75, 0x01,
+	/* Report Count (224) */
+	0x95, 0xE0,
+	/* Input (Data, Variable, Absolute) */
+	0x81, 0x02,
+
 	/* End Collection */
 	0xC0
 };
 
+/* Descriptor presented to the host: peer_report_desc[] once per peer */
+static uint8_t hid_report_desc[sizeof(peer_report_desc) * CONFIG_APP_MAX_PERIPHERALS];
+
+/* Report body size (without report ID) for each report kind */
+static const uint8_t report_sizes[APP_USB_HID_REPORT_ID_COUNT + 1] = {
+	[APP_USB_HID_REPORT_ID_KEYBOARD] = APP_USB_HID_KEYBOARD_SIZE,
+	[APP_USB_HID_REPORT_ID_CONSUMER] = APP_USB_HID_CONSUMER_SIZE,
+	[APP_USB_HID_REPORT_ID_MOUSE] = APP_USB_HID_MOUSE_SIZE,
+	[APP_USB_HID_REPORT_ID_NKRO] = APP_USB_HID_NKRO_SIZE,
+};
+
+BUILD_ASSERT(APP_USB_HID_REPORT_MAX_SIZE <= CONFIG_HID_INTERRUPT_EP_MPS,
+	     "Largest report does not fit the HID interrupt endpoint");
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+BUILD_ASSERT(CONFIG_APP_MAX_PERIPHERALS == 1,
+	     "Report Map passthrough supports a single peripheral");
+
+/* Peripheral Report Map presented instead of hid_report_desc[] */
+static uint8_t passthrough_desc[CONFIG_APP_HID_PASSTHROUGH_MAP_MAX_SIZE];
+static size_t passthrough_desc_len;
+/* Length of each report ID seen, so release-all can send empty ones */
+static uint8_t passthrough_sizes[UINT8_MAX + 1];
+#endif
+static bool passthrough_active;
+
 static const struct device *hid_dev;
 static bool usb_configured;
 static bool hid_ready;
+/* Host selected Boot Protocol: only the keyboard report, without ID */
+static atomic_t boot_protocol;
 static K_SEM_DEFINE(hid_sem, 1, 1);
 
+/* Reports queued by the bridge, drained by the USB TX thread */
+static struct report_ring tx_ring;
+static K_SEM_DEFINE(tx_sem, 0, 1);
+
+/*
+ * Last report queued per ID (producer side), to spot key releases and
+ * duplicates. Holds a reference, the report is not copied.
+ */
+static struct report_buf *last_queued[APP_USB_HID_REPORT_ID_TOTAL + 1];
+/* Next report taken out of the ring but not merged (consumer side) */
+static struct report_buf *lookahead;
+/*
+ * Reports moved out of the ring and merged while the host is not
+ * polling (consumer side), sent before the ring. Oldest first.
+ */
+static struct report_buf *held[CONFIG_APP_USB_TX_RING_SIZE];
+static uint8_t held_count;
+
+/*
+ * Host suspended the bus: the TX thread holds reports until resume,
+ * the first report queued while suspended signals remote wakeup.
+ */
+static atomic_t suspended;
+static atomic_t wakeup_requested;
+static K_SEM_DEFINE(resume_sem, 0, 1);
+
+/*
+ * Key release requests. Not queued in the ring, so they cannot be
+ * dropped and go out ahead of pending reports: a bit per peer, picked up
+ * by the TX thread. Bumping the peer's generation makes the reports it
+ * queued before the release stale, they are discarded instead of
+ * pressing the keys again.
+ */
+static atomic_t release_pending;
+static atomic_t peer_gen[CONFIG_APP_MAX_PERIPHERALS];
+/* Empty reports still to send for the releases being processed */
+static uint8_t release_queue[UINT8_MAX + 1];
+static uint16_t release_count;
+static uint16_t release_next;
+
+/* Report currently in the IN endpoint, released on completion */
+static atomic_ptr_t inflight;
+static uint32_t inflight_write_ts;
+
+#if defined(CONFIG_APP_USB_SOF_ALIGN)
+/* latency_now() at the last Start of Frame, 0 before the first one */
+static atomic_t sof_ts;
+
+/* Where in the current USB frame an event falls */
+static void record_frame_phase(enum latency_stage stage, uint32_t ts)
+{
+	uint32_t sof = atomic_get(&sof_ts);
+
+	if (sof) {
+		latency_record_phase(stage, sof, ts, LATENCY_USB_FRAME_US);
+	}
+}
+#else
+static inline void record_frame_phase(enum latency_stage stage, uint32_t ts) {}
+#endif
+
+/*
+ * Host poll time: from hid_int_ep_write() to the IN transfer completing,
+ * in microseconds. Smoothed like a TCP round-trip time (RFC 6298):
+ * poll_avg is the mean scaled by 8, poll_dev the mean deviation scaled
+ * by 4. The TX timeout is mean + 4 * deviation.
+ */
+static atomic_t write_pending;
+static uint32_t write_cycles;
+static uint8_t write_report_id;
+static uint32_t poll_avg;
+static uint32_t poll_dev;
+static bool poll_valid;
+/* An IN transfer outlived the TX timeout, see host_not_polling_check() */
+static atomic_t host_not_polling;
+
+static void poll_sample(uint32_t us)
+{
+	int32_t err;
+
+	if (!poll_valid) {
+		poll_avg = us << 3;
+		poll_dev = us << 1;
+		poll_valid = true;
+		return;
+	}
+
+	err = (int32_t)us - (int32_t)(poll_avg >> 3);
+	poll_avg += err;
+	poll_dev += (err < 0 ? -err : err) - (poll_dev >> 2);
+}
+
+/* How long the TX thread waits for an IN transfer to complete */
+static uint32_t tx_timeout_us(void)
+{
+	uint32_t us = CONFIG_APP_USB_TX_TIMEOUT_MAX_MS * USEC_PER_MSEC;
+
+	/* Keep probing at the slowest rate until the host is back */
+	if (poll_valid && !atomic_get(&host_not_polling)) {
+		us = CLAMP((poll_avg >> 3) + poll_dev,
+			   CONFIG_APP_USB_TX_TIMEOUT_MIN_MS * USEC_PER_MSEC, us);
+	}
+
+	return us;
+}
+
+/* Peripheral a report belongs to, from its report ID */
+static uint8_t report_peer(uint8_t report_id)
+{
+	if (passthrough_active || report_id == 0) {
+		return 0;
+	}
+
+	return MIN((report_id - 1) / APP_USB_HID_REPORT_ID_COUNT,
+		   CONFIG_APP_MAX_PERIPHERALS - 1);
+}
+
+/* Called just before an IN transfer is started */
+static void write_started(uint8_t report_id)
+{
+	write_cycles = k_cycle_get_32();
+	write_report_id = report_id;
+	atomic_set(&write_pending, 1);
+}
+
 static void int_in_ready_cb(const struct device *dev)
 {
+	struct report_buf *buf = atomic_ptr_set(&inflight, NULL);
+
 	ARG_UNUSED(dev);
+
+	/* A host that stopped polling says nothing about its cadence */
+	if (atomic_cas(&write_pending, 1, 0)) {
+		trace_record(TRACE_EV_COMPLETE, report_peer(write_report_id),
+			     write_report_id, 0, NULL, 0);
+
+		if (!atomic_get(&host_not_polling)) {
+			poll_sample(k_cyc_to_us_floor32(k_cycle_get_32() - write_cycles));
+		}
+	}
+
+	if (buf) {
+		uint32_t now = latency_now();
+
+		latency_record(LATENCY_STAGE_USB, inflight_write_ts, now);
+		latency_record(LATENCY_STAGE_TOTAL, buf->timestamp, now);
+		record_frame_phase(LATENCY_STAGE_POLL_PHASE, now);
+		bench_report_done(buf->timestamp, inflight_write_ts, now);
+		report_pool_unref(buf);
+		app_stats_inc(APP_STAT_USB_SENT);
+	}
+
 	k_sem_give(&hid_sem);
 }
 
+static void protocol_change_cb(const struct device *dev, uint8_t protocol)
+{
+	ARG_UNUSED(dev);
+
+	LOG_INF("Host selected %s protocol",
+		protocol == HID_PROTOCOL_BOOT ? "Boot" : "Report");
+	atomic_set(&boot_protocol, protocol == HID_PROTOCOL_BOOT);
+}
+
+#if defined(CONFIG_APP_HOST_LEDS)
+static app_usb_hid_output_cb_t output_callback;
+
+/*
+ * Output report from the host, on the interrupt OUT endpoint or through
+ * SET_REPORT. In Boot Protocol the report has no ID byte and belongs to
+ * the first keyboard.
+ */
+static void output_report(const uint8_t *data, size_t len)
+{
+	uint8_t report_id;
+
+	if (len == 0 || !output_callback) {
+		return;
+	}
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	/* A peer Report Map without report IDs has no ID byte either */
+	if (passthrough_active && passthrough_sizes[0]) {
+		output_callback(0, data, MIN(len, UINT8_MAX));
+		return;
+	}
+#endif
+
+	if (atomic_get(&boot_protocol) && !passthrough_active) {
+		report_id = APP_USB_HID_REPORT_ID(0, APP_USB_HID_REPORT_ID_KEYBOARD);
+	} else {
+		if (len < 2) {
+			return;
+		}
+
+		report_id = *data++;
+		len--;
+	}
+
+	output_callback(report_id, data, MIN(len, UINT8_MAX));
+}
+
+static void int_out_ready_cb(const struct device *dev)
+{
+	uint8_t data[CONFIG_HID_INTERRUPT_EP_MPS];
+	uint32_t len = 0;
+
+	if (hid_int_ep_read(dev, data, sizeof(data), &len) == 0) {
+		output_report(data, len);
+	}
+}
+
+static int set_report_cb(const struct device *dev, struct usb_setup_packet *setup,
+			 int32_t *len, uint8_t **data)
+{
+	ARG_UNUSED(dev);
+
+	/* wValue: report type in the high byte */
+	if ((setup->wValue >> 8) == HID_REPORT_TYPE_OUTPUT && *len > 0) {
+		output_report(*data, *len);
+	}
+
+	return 0;
+}
+#endif /* CONFIG_APP_HOST_LEDS */
+
+static void set_suspended(bool suspend)
+{
+	atomic_set(&suspended, suspend);
+	atomic_clear(&wakeup_requested);
+
+	if (!suspend) {
+		/* Flush whatever was held while suspended */
+		k_sem_give(&resume_sem);
+	}
+}
+
 static void status_cb(enum usb_dc_status_code status, const uint8_t *param)
 {
 	ARG_UNUSED(param);
@@ -106,21 +557,40 @@ static void status_cb(enum usb_dc_status_code status, const uint8_t *param)
 	case USB_DC_CONFIGURED:
 		LOG_INF("USB configured");
 		usb_configured = true;
+		set_suspended(false);
+		app_event_post(APP_EVENT_USB_CONFIGURED);
+		/* A write from before the reset never completed */
+		atomic_clear(&write_pending);
+		atomic_clear(&host_not_polling);
 		/* Signal HID endpoint ready */
 		if (hid_dev) {
 			int_in_ready_cb(hid_dev);
 		}
 		break;
+	case USB_DC_RESET:
+		/* Report Protocol is the default after reset */
+		atomic_clear(&boot_protocol);
+		set_suspended(false);
+		break;
 	case USB_DC_DISCONNECTED:
 		LOG_INF("USB disconnected");
 		usb_configured = false;
+		set_suspended(false);
 		break;
 	case USB_DC_SUSPEND:
 		LOG_DBG("USB suspended");
+		app_stats_inc(APP_STAT_USB_SUSPENDS);
+		set_suspended(true);
 		break;
 	case USB_DC_RESUME:
 		LOG_DBG("USB resumed");
+		set_suspended(false);
 		break;
+#if defined(CONFIG_APP_USB_SOF_ALIGN)
+	case USB_DC_SOF:
+		atomic_set(&sof_ts, latency_now());
+		break;
+#endif
 	default:
 		break;
 	}
@@ -128,8 +598,50 @@ static void status_cb(enum usb_dc_status_code status, const uint8_t *param)
 
 static const struct hid_ops hid_ops = {
 	.int_in_ready = int_in_ready_cb,
+	.protocol_change = protocol_change_cb,
+#if defined(CONFIG_APP_HOST_LEDS)
+	.int_out_ready = int_out_ready_cb,
+	.set_report = set_report_cb,
+#endif
 };
 
+/*
+ * Add offset to the data of every Report ID item. Walks the short items
+ * of a descriptor; peer_report_desc[] has no long items.
+ */
+static void offset_report_ids(uint8_t *desc, size_t len, uint8_t offset)
+{
+	size_t i = 0;
+
+	while (i < len) {
+		uint8_t prefix = desc[i];
+		uint8_t size = prefix & 0x03;
+
+		if (size == 3) {
+			size = 4;
+		}
+
+		/* Report ID: global item, tag 8, one data byte */
+		if ((prefix & 0xFC) == 0x84 && size == 1 && i + 1 < len) {
+			desc[i + 1] += offset;
+		}
+
+		i += 1 + size;
+	}
+}
+
+/* One copy of peer_report_desc[] per peer, with its own report IDs */
+static void build_report_desc(void)
+{
+	for (uint8_t peer = 0; peer < CONFIG_APP_MAX_PERIPHERALS; peer++) {
+		uint8_t *desc = &hid_report_desc[peer * sizeof(peer_report_desc)];
+
+		memcpy(desc, peer_report_desc, sizeof(peer_report_desc));
+		offset_report_ids(desc, sizeof(peer_report_desc),
+				  APP_USB_HID_REPORT_ID(peer, 0));
+	}
+}
+
 int app_usb_hid_init(void)
 {
 	int ret;
@@ -145,10 +657,37 @@ int app_usb_hid_init(void)
 
 	LOG_INF("Found HID device: %s", hid_dev->name);
 
-	usb_hid_register_device(hid_dev, hid_report_desc,
-				sizeof(hid_report_desc), &hid_ops);
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	/* Enumerate with the Report Map of the last peer, if cached */
+	bt_addr_le_t last;
+
+	if (bond_cache_get_last(&last) == 0) {
+		ssize_t len = bond_cache_load(&last, BOND_CACHE_REPORT_MAP,
+					      passthrough_desc,
+					      sizeof(passthrough_desc));
+		if (len > 0) {
+			passthrough_desc_len = len;
+			passthrough_active = true;
+			LOG_INF("Using cached Report Map (%zu bytes)",
+				passthrough_desc_len);
+		}
+	}
 
-	if (usb_hid_set_proto_code(hid_dev, HID_BOOT_IFACE_CODE_KEYBOARD)) {
+	if (passthrough_active) {
+		usb_hid_register_device(hid_dev, passthrough_desc,
+					passthrough_desc_len, &hid_ops);
+	} else
+#endif
+	{
+		build_report_desc();
+		usb_hid_register_device(hid_dev, hid_report_desc,
+					sizeof(hid_report_desc), &hid_ops);
+	}
+
+	/* The peer's map is not necessarily a boot keyboard */
+	if (usb_hid_set_proto_code(hid_dev, passthrough_active ?
+				   HID_BOOT_IFACE_CODE_NONE :
+				   HID_BOOT_IFACE_CODE_KEYBOARD)) {
 		LOG_WRN("Failed to set Protocol Code");
 	}
 
@@ -176,44 +715,769 @@ int app_usb_hid_init(void)
 	return 0;
 }
 
-int app_usb_hid_send_report(const uint8_t *report)
+/* True if any 8-bit usage in prev is missing from cur */
+static bool usage_released_u8(const uint8_t *prev, const uint8_t *cur, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (prev[i] && !memchr(cur, prev[i], n)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* True if any 16-bit usage in prev is missing from cur */
+static bool usage_released_u16(const uint8_t *prev, const uint8_t *cur, size_t n)
+{
+	for (size_t i = 0; i < n; i += 2) {
+		uint16_t usage = sys_get_le16(&prev[i]);
+		bool found = false;
+
+		if (!usage) {
+			continue;
+		}
+
+		for (size_t j = 0; j < n; j += 2) {
+			if (sys_get_le16(&cur[j]) == usage) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* True if any bit set in prev is clear in cur */
+static bool bits_released(const uint8_t *prev, const uint8_t *cur, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (prev[i] & ~cur[i]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Decide whether a report may later be merged with the next report of
+ * the same ID. Key releases and relative mouse motion are never merged,
+ * so coalescing cannot lose a key-up or a movement delta.
+ */
+static uint8_t coalesce_flags(uint8_t report_id, const uint8_t *report)
+{
+	static const uint8_t empty_report[APP_USB_HID_REPORT_MAX_SIZE] = {0};
+	const uint8_t *prev;
+	bool release;
+
+	if (passthrough_active || report_id == 0 ||
+	    report_id > APP_USB_HID_REPORT_ID_TOTAL) {
+		/* Unknown layout */
+		return REPORT_BUF_FLAG_NO_COALESCE;
+	}
+
+	prev = last_queued[report_id] ? &last_queued[report_id]->data[1] :
+	       empty_report;
+
+	switch (APP_USB_HID_REPORT_KIND(report_id)) {
+	case APP_USB_HID_REPORT_ID_KEYBOARD:
+		release = bits_released(prev, report, 1) ||
+			  usage_released_u8(&prev[2], &report[2],
+					    APP_USB_HID_KEYBOARD_SIZE - 2);
+		break;
+	case APP_USB_HID_REPORT_ID_CONSUMER:
+		release = usage_released_u16(prev, report,
+					     APP_USB_HID_CONSUMER_SIZE);
+		break;
+	case APP_USB_HID_REPORT_ID_NKRO:
+		release = bits_released(prev, report, APP_USB_HID_NKRO_SIZE);
+		break;
+	default:
+		return REPORT_BUF_FLAG_NO_COALESCE;
+	}
+
+	return release ? REPORT_BUF_FLAG_NO_COALESCE : 0;
+}
+
+/* Remember the report just queued, replacing the previous one of its ID */
+static void set_last_queued(struct report_buf *buf)
+{
+	uint8_t report_id = buf->data[0];
+
+	if (passthrough_active || report_id == 0 ||
+	    report_id > APP_USB_HID_REPORT_ID_TOTAL) {
+		report_pool_unref(buf);
+		return;
+	}
+
+	report_pool_unref(last_queued[report_id]);
+	last_queued[report_id] = buf;
+}
+
+static bool can_merge(const struct report_buf *older,
+		      const struct report_buf *newer)
+{
+	return older->data[0] == newer->data[0] &&
+	       !((older->flags | newer->flags) & REPORT_BUF_FLAG_NO_COALESCE);
+}
+
+/*
+ * Add a report to held[], replacing the newest held report of its ID if
+ * the two can merge. Reports of other IDs describe other state, so the
+ * replacement may overtake them.
+ */
+static void hold_report(struct report_buf *buf)
+{
+	for (int i = held_count - 1; i >= 0; i--) {
+		if (held[i]->data[0] != buf->data[0]) {
+			continue;
+		}
+
+		if (can_merge(held[i], buf)) {
+			report_pool_unref(held[i]);
+			held[i] = buf;
+			app_stats_inc(APP_STAT_BRIDGE_COALESCED);
+			return;
+		}
+		break;
+	}
+
+	held[held_count++] = buf;
+}
+
+/*
+ * The host is not polling: move what is queued out of the ring, merged,
+ * so the ring has room again and does not evict older reports - those
+ * may hold key releases. Once held[] is full the ring overflows as usual.
+ */
+static void hold_reports(void)
+{
+	struct report_buf *buf;
+
+	if (lookahead && held_count < ARRAY_SIZE(held)) {
+		hold_report(lookahead);
+		lookahead = NULL;
+	}
+
+	while (held_count < ARRAY_SIZE(held) &&
+	       (buf = report_ring_get(&tx_ring)) != NULL) {
+		hold_report(buf);
+	}
+}
+
+/*
+ * Take the next report to send. Consecutive reports of the same ID that
+ * piled up while the endpoint was busy collapse into the newest one,
+ * with CONFIG_APP_REPORT_COALESCE or while the host is not polling.
+ */
+static struct report_buf *next_report(void)
+{
+	struct report_buf *buf = lookahead;
+	struct report_buf *next;
+
+	if (held_count) {
+		buf = held[0];
+		held_count--;
+		memmove(&held[0], &held[1], held_count * sizeof(held[0]));
+		return buf;
+	}
+
+	lookahead = NULL;
+	if (!buf) {
+		buf = report_ring_get(&tx_ring);
+		if (!buf) {
+			return NULL;
+		}
+	}
+
+	if (!IS_ENABLED(CONFIG_APP_REPORT_COALESCE) &&
+	    !atomic_get(&host_not_polling)) {
+		return buf;
+	}
+
+	while ((next = report_ring_get(&tx_ring)) != NULL) {
+		if (!can_merge(buf, next)) {
+			lookahead = next;
+			break;
+		}
+
+		report_pool_unref(buf);
+		buf = next;
+		app_stats_inc(APP_STAT_BRIDGE_COALESCED);
+	}
+
+	return buf;
+}
+
+static bool report_stale(const struct report_buf *buf)
+{
+	uint8_t peer = report_peer(buf->data[0]);
+
+	return buf->gen != (uint8_t)atomic_get(&peer_gen[peer]);
+}
+
+/* Turn the pending release bits into a list of empty reports to send */
+static void collect_releases(void)
+{
+	atomic_val_t peers = atomic_clear(&release_pending);
+
+	release_count = 0;
+	release_next = 0;
+
+	if (!peers) {
+		return;
+	}
+
+	if (passthrough_active) {
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+		/* Single peer: every report ID it has sent */
+		for (int id = 0; id <= UINT8_MAX; id++) {
+			if (passthrough_sizes[id]) {
+				release_queue[release_count++] = id;
+			}
+		}
+#endif
+		return;
+	}
+
+	if (atomic_get(&boot_protocol)) {
+		/* One bare keyboard report is all the host sees */
+		release_queue[release_count++] =
+			APP_USB_HID_REPORT_ID(0, APP_USB_HID_REPORT_ID_KEYBOARD);
+		return;
+	}
+
+	for (uint8_t peer = 0; peer < CONFIG_APP_MAX_PERIPHERALS; peer++) {
+		if (!(peers & BIT(peer))) {
+			continue;
+		}
+
+		for (uint8_t kind = 1; kind <= APP_USB_HID_REPORT_ID_COUNT; kind++) {
+			release_queue[release_count++] = APP_USB_HID_REPORT_ID(peer, kind);
+		}
+	}
+}
+
+/*
+ * Write one empty report from a static buffer, no pool buffer needed.
+ * Called with the endpoint taken, gives it back if nothing was written.
+ */
+static void write_release(uint8_t report_id)
+{
+	static uint8_t data[APP_USB_HID_REPORT_MAX_SIZE];
+	uint8_t *start = data;
+	uint8_t len;
+	int ret;
+
+	if (!usb_configured) {
+		k_sem_give(&hid_sem);
+		return;
+	}
+
+	memset(data, 0, sizeof(data));
+	data[0] = report_id;
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+	if (passthrough_active) {
+		len = 1 + passthrough_sizes[report_id];
+	} else
+#endif
+	{
+		len = 1 + app_usb_hid_report_size(report_id);
+	}
+
+	if (report_id == 0 ||
+	    (atomic_get(&boot_protocol) && !passthrough_active)) {
+		/* No report ID byte on the wire */
+		start++;
+		len--;
+	}
+
+	write_started(report_id);
+	ret = hid_int_ep_write(hid_dev, start, len, NULL);
+	trace_record(TRACE_EV_RELEASE, report_peer(report_id), report_id, -ret,
+		     NULL, 0);
+	if (ret != 0) {
+		atomic_clear(&write_pending);
+		app_stats_inc(APP_STAT_USB_WRITE_ERRORS);
+		APP_LOG_RATELIMIT(LOG_ERR, "Failed to send key release: %d", ret);
+		k_sem_give(&hid_sem);
+		return;
+	}
+
+	app_stats_inc(APP_STAT_USB_RELEASES);
+}
+
+/*
+ * The IN transfer outlived the TX timeout. Unless the bus is suspended
+ * or gone, the host has stopped polling: say so once, and coalesce what
+ * is queued instead of letting the ring evict it.
+ */
+static void host_not_polling_check(void)
+{
+	if (atomic_get(&suspended) || !usb_configured) {
+		return;
+	}
+
+	if (!atomic_set(&host_not_polling, 1)) {
+		app_stats_inc(APP_STAT_USB_TIMEOUTS);
+		trace_record(TRACE_EV_HOST_STALL, report_peer(write_report_id),
+			     write_report_id, 0, NULL, 0);
+		APP_LOG_RATELIMIT(LOG_WRN, "Host not polling, coalescing reports");
+	}
+
+	hold_reports();
+}
+
+/*
+ * USB TX thread
+ * Waits for the IN endpoint to become free (int_in_ready_cb), then
+ * writes the oldest queued report. Taking the endpoint first means the
+ * ring absorbs bursts while the host is slow to poll.
+ */
+static void usb_tx_thread(void *p1, void *p2, void *p3)
+{
+	struct report_buf *buf;
+	const uint8_t *data;
+	uint32_t wait_start;
+	uint8_t len;
+	int ret;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (1) {
+		/* Wait for previous report to complete */
+		wait_start = latency_now();
+		while (k_sem_take(&hid_sem, K_USEC(tx_timeout_us())) != 0) {
+			host_not_polling_check();
+		}
+		latency_record(LATENCY_STAGE_EP_WAIT, wait_start, latency_now());
+
+		if (atomic_clear(&host_not_polling)) {
+			LOG_INF("Host polling again");
+		}
+
+		/* Hold reports while the bus is suspended, flushed on resume */
+		while (atomic_get(&suspended)) {
+			k_sem_take(&resume_sem, K_FOREVER);
+		}
+
+		/* Wait for a release or a report to send, releases first */
+		buf = NULL;
+		while (1) {
+			if (release_next == release_count) {
+				collect_releases();
+			}
+
+			if (release_next < release_count ||
+			    (buf = next_report()) != NULL) {
+				break;
+			}
+
+			k_sem_take(&tx_sem, K_FOREVER);
+		}
+
+		if (!buf) {
+			write_release(release_queue[release_next++]);
+			continue;
+		}
+
+		if (report_stale(buf)) {
+			/* Queued before its peer's keys were released */
+			app_stats_inc(APP_STAT_USB_STALE);
+			trace_record(TRACE_EV_STALE, report_peer(buf->data[0]),
+				     buf->data[0], 0, &buf->data[1], buf->len - 1);
+			report_pool_unref(buf);
+			k_sem_give(&hid_sem);
+			continue;
+		}
+
+		data = buf->data;
+		len = buf->len;
+
+		if (atomic_get(&boot_protocol) && !passthrough_active) {
+			/* Boot Protocol: bare 8-byte keyboard report, no ID */
+			if (APP_USB_HID_REPORT_KIND(data[0]) !=
+			    APP_USB_HID_REPORT_ID_KEYBOARD) {
+				report_pool_unref(buf);
+				k_sem_give(&hid_sem);
+				continue;
+			}
+			data++;
+			len--;
+		} else if (data[0] == 0) {
+			/* Passthrough of a Report Map without report IDs */
+			data++;
+			len--;
+		}
+
+		if (!usb_configured) {
+			/* Host went away while the report was queued */
+			report_pool_unref(buf);
+			k_sem_give(&hid_sem);
+			continue;
+		}
+
+		/* The endpoint owns the buffer until int_in_ready_cb() */
+		inflight_write_ts = latency_now();
+		latency_record(LATENCY_STAGE_QUEUE, buf->timestamp, inflight_write_ts);
+		atomic_ptr_set(&inflight, buf);
+
+		write_started(buf->data[0]);
+		ret = hid_int_ep_write(hid_dev, data, len, NULL);
+		trace_record(TRACE_EV_WRITE, report_peer(buf->data[0]), buf->data[0],
+			     -ret, &buf->data[1], buf->len - 1);
+		if (ret != 0) {
+			atomic_clear(&write_pending);
+			app_stats_inc(APP_STAT_USB_WRITE_ERRORS);
+			APP_LOG_RATELIMIT(LOG_ERR, "Failed to send HID report: %d",
+					  ret);
+			report_pool_unref(atomic_ptr_set(&inflight, NULL));
+			k_sem_give(&hid_sem);
+		}
+	}
+}
+
+K_THREAD_DEFINE(usb_tx_tid, CONFIG_APP_USB_TX_THREAD_STACK_SIZE,
+		usb_tx_thread, NULL, NULL, NULL,
+		K_PRIO_COOP(CONFIG_APP_USB_TX_THREAD_PRIO), 0, 0);
+
+uint8_t app_usb_hid_report_size(uint8_t report_id)
+{
+	if (report_id == 0 || report_id > APP_USB_HID_REPORT_ID_TOTAL) {
+		return 0;
+	}
+
+	return report_sizes[APP_USB_HID_REPORT_KIND(report_id)];
+}
+
+/* Ask the host to resume the bus, once per suspend */
+static void wake_host(void)
 {
+#if defined(CONFIG_APP_USB_REMOTE_WAKEUP)
+	int ret;
+
+	if (!atomic_cas(&wakeup_requested, 0, 1)) {
+		return;
+	}
+
+	ret = usb_wakeup_request();
+	if (ret == -EACCES) {
+		APP_LOG_RATELIMIT(LOG_WRN, "Host has not enabled remote wakeup");
+	} else if (ret) {
+		APP_LOG_RATELIMIT(LOG_WRN, "Remote wakeup failed: %d", ret);
+	} else {
+		LOG_DBG("Remote wakeup signalled");
+		app_stats_inc(APP_STAT_USB_WAKEUPS);
+	}
+#endif
+}
+
+int app_usb_hid_submit(struct report_buf *buf)
+{
+	uint8_t report_id = buf->data[0];
+	uint8_t len = buf->len - 1;
 	int ret;
 
 	if (!hid_ready || !hid_dev) {
-		return -ENODEV;
+		ret = -ENODEV;
+		goto drop;
 	}
 
 	if (!usb_configured) {
-		return -ENOTCONN;
+		ret = -ENOTCONN;
+		goto drop;
+	}
+
+	if (passthrough_active) {
+		if (buf->len > APP_USB_HID_REPORT_MAX_SIZE) {
+			ret = -EINVAL;
+			goto drop;
+		}
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+		passthrough_sizes[report_id] = len;
+#endif
+	} else if (len != app_usb_hid_report_size(report_id)) {
+		ret = -EINVAL;
+		goto drop;
+	}
+
+	buf->gen = (uint8_t)atomic_get(&peer_gen[report_peer(report_id)]);
+	record_frame_phase(LATENCY_STAGE_NOTIFY_PHASE, buf->timestamp);
+
+	if (atomic_get(&suspended)) {
+		/*
+		 * Keep the first keystrokes, they are what wakes the host:
+		 * once the burst is full, newer reports are dropped instead
+		 * of evicting older ones.
+		 */
+		if (report_ring_count(&tx_ring) >= CONFIG_APP_USB_SUSPEND_BURST) {
+			ret = -ENOBUFS;
+			goto drop;
+		}
+
+		wake_host();
+	}
+
+	buf->flags |= coalesce_flags(report_id, &buf->data[1]);
+	/* Kept until the next report of this ID, the ring takes the other */
+	report_pool_ref(buf);
+
+	/* Queue for the USB TX thread - never blocks the caller */
+	ret = report_ring_put(&tx_ring, buf);
+	/* Our reference keeps buf valid, also if the ring dropped it */
+	trace_record(TRACE_EV_ENQUEUE, report_peer(report_id), report_id, -ret,
+		     &buf->data[1], len);
+	if (ret != -ENOBUFS) {
+		set_last_queued(buf);
+		k_sem_give(&tx_sem);
+	} else {
+		report_pool_unref(buf);
+	}
+
+	return ret;
+
+drop:
+	trace_record(TRACE_EV_ENQUEUE, report_peer(report_id), report_id, -ret,
+		     &buf->data[1], len);
+	report_pool_unref(buf);
+	return ret;
+}
+
+int app_usb_hid_send_report(uint8_t report_id, const uint8_t *report,
+			    uint8_t len, uint32_t timestamp)
+{
+	struct report_buf *buf;
+
+	if (len >= APP_USB_HID_REPORT_MAX_SIZE) {
+		return -EINVAL;
+	}
+
+	buf = report_pool_alloc(report_id, timestamp);
+	if (!buf) {
+		return -ENOMEM;
 	}
 
-	/* Wait for previous report to complete */
-	ret = k_sem_take(&hid_sem, K_MSEC(100));
+	memcpy(&buf->data[1], report, len);
+	buf->len = len + 1;
+
+	return app_usb_hid_submit(buf);
+}
+
+bool app_usb_hid_is_duplicate(const struct report_buf *buf)
+{
+#if defined(CONFIG_APP_REPORT_COALESCE)
+	uint8_t report_id = buf->data[0];
+	const struct report_buf *last;
+
+	if (passthrough_active || report_id == 0 ||
+	    report_id > APP_USB_HID_REPORT_ID_TOTAL) {
+		return false;
+	}
+
+	last = last_queued[report_id];
+	if (!last) {
+		/* Nothing sent yet: the host starts from all zeroes */
+		for (uint8_t i = 1; i < buf->len; i++) {
+			if (buf->data[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	return last->len == buf->len &&
+	       memcmp(last->data, buf->data, buf->len) == 0;
+#else
+	ARG_UNUSED(buf);
+	return false;
+#endif
+}
+
+uint32_t app_usb_hid_coalesced_count(void)
+{
+	return app_stats_get(APP_STAT_BRIDGE_COALESCED);
+}
+
+int app_usb_hid_release_all(void)
+{
+	LOG_DBG("Releasing all keys");
+
+	for (uint8_t peer = 0; peer < CONFIG_APP_MAX_PERIPHERALS; peer++) {
+		app_usb_hid_release_peer(peer);
+	}
+
+	return 0;
+}
+
+int app_usb_hid_release_peer(uint8_t peer)
+{
+	if (peer >= CONFIG_APP_MAX_PERIPHERALS) {
+		return -EINVAL;
+	}
+
+	/* Everything the peer queued so far predates the release */
+	atomic_inc(&peer_gen[peer]);
+
+	/* The host is back to all zeroes for this peer */
+	for (uint8_t kind = 1; kind <= APP_USB_HID_REPORT_ID_COUNT; kind++) {
+		uint8_t id = APP_USB_HID_REPORT_ID(peer, kind);
+
+		report_pool_unref(last_queued[id]);
+		last_queued[id] = NULL;
+	}
+
+	atomic_or(&release_pending, BIT(peer));
+	k_sem_give(&tx_sem);
+
+	return 0;
+}
+
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+int app_usb_hid_set_report_map(const uint8_t *map, size_t len)
+{
+	int ret;
+
+	if (!hid_dev) {
+		return -ENODEV;
+	}
+
+	if (!map) {
+		if (!passthrough_active) {
+			/* Host already has the default descriptor */
+			return 0;
+		}
+		LOG_INF("Re-enumerating with the default report descriptor");
+	} else if (len == 0 || len > sizeof(passthrough_desc)) {
+		return -EINVAL;
+	} else if (passthrough_active && len == passthrough_desc_len &&
+		   memcmp(map, passthrough_desc, len) == 0) {
+		/* Host already has this descriptor */
+		return 0;
+	} else {
+		LOG_INF("Re-enumerating with peer Report Map (%zu bytes)", len);
+	}
+
+	/* Stop the TX thread from using the endpoint while USB restarts */
+	hid_ready = false;
+	usb_configured = false;
+
+	ret = usb_disable();
+	if (ret != 0 && ret != -EALREADY) {
+		LOG_ERR("Failed to disable USB: %d", ret);
+		return ret;
+	}
+
+	if (map) {
+		memcpy(passthrough_desc, map, len);
+		passthrough_desc_len = len;
+		memset(passthrough_sizes, 0, sizeof(passthrough_sizes));
+		passthrough_active = true;
+
+		usb_hid_register_device(hid_dev, passthrough_desc,
+					passthrough_desc_len, &hid_ops);
+	} else {
+		passthrough_active = false;
+
+		/* Not built at init when a cached map was used */
+		build_report_desc();
+		usb_hid_register_device(hid_dev, hid_report_desc,
+					sizeof(hid_report_desc), &hid_ops);
+	}
+
+	if (usb_hid_set_proto_code(hid_dev, passthrough_active ?
+				   HID_BOOT_IFACE_CODE_NONE :
+				   HID_BOOT_IFACE_CODE_KEYBOARD)) {
+		LOG_WRN("Failed to set Protocol Code");
+	}
+
+	ret = usb_hid_init(hid_dev);
 	if (ret != 0) {
-		LOG_WRN("HID report timeout");
+		LOG_ERR("Failed to init HID device: %d", ret);
 		return ret;
 	}
 
-	ret = hid_int_ep_write(hid_dev, report, APP_USB_HID_REPORT_SIZE, NULL);
+	ret = usb_enable(status_cb);
 	if (ret != 0) {
-		LOG_ERR("Failed to send HID report: %d", ret);
-		k_sem_give(&hid_sem);
+		LOG_ERR("Failed to enable USB: %d", ret);
 		return ret;
 	}
 
+	hid_ready = true;
 	return 0;
 }
+#else
+int app_usb_hid_set_report_map(const uint8_t *map, size_t len)
+{
+	ARG_UNUSED(map);
+	ARG_UNUSED(len);
 
-int app_usb_hid_release_all(void)
+	return -ENOTSUP;
+}
+#endif /* CONFIG_APP_HID_PASSTHROUGH */
+
+bool app_usb_hid_passthrough_active(void)
 {
-	static const uint8_t empty_report[APP_USB_HID_REPORT_SIZE] = {0};
+	return passthrough_active;
+}
 
-	LOG_DBG("Releasing all keys");
-	return app_usb_hid_send_report(empty_report);
+bool app_usb_hid_boot_protocol(void)
+{
+	return atomic_get(&boot_protocol) && !passthrough_active;
 }
 
 bool app_usb_hid_ready(void)
 {
 	return hid_ready && usb_configured;
 }
+
+enum app_usb_hid_host_state app_usb_hid_host_state(void)
+{
+	if (!usb_configured) {
+		return APP_USB_HID_HOST_NOT_CONFIGURED;
+	}
+
+	if (atomic_get(&suspended)) {
+		return APP_USB_HID_HOST_SUSPENDED;
+	}
+
+	return atomic_get(&host_not_polling) ? APP_USB_HID_HOST_NOT_POLLING :
+	       APP_USB_HID_HOST_POLLING;
+}
+
+void app_usb_hid_print_host(void)
+{
+	static const char *const names[] = {
+		[APP_USB_HID_HOST_NOT_CONFIGURED] = "not configured",
+		[APP_USB_HID_HOST_SUSPENDED] = "suspended",
+		[APP_USB_HID_HOST_NOT_POLLING] = "not polling",
+		[APP_USB_HID_HOST_POLLING] = "polling",
+	};
+
+	printk("USB host: %s\n", names[app_usb_hid_host_state()]);
+
+	if (poll_valid) {
+		printk("  poll time %u us (deviation %u us), timeout %u us\n",
+		       poll_avg >> 3, poll_dev >> 2,
+		       tx_timeout_us());
+	}
+
+	printk("\n");
+}
+
+void app_usb_hid_set_output_cb(app_usb_hid_output_cb_t cb)
+{
+#if defined(CONFIG_APP_HOST_LEDS)
+	output_callback = cb;
+#else
+	ARG_UNUSED(cb);
+#endif
+}
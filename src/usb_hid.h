@@ -3,15 +3,59 @@
 #ifndef APP_USB_HID_H_
 #define APP_USB_HID_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-/* Boot keyboard report: 8 bytes
+/* Report IDs of the composite USB HID descriptor */
+#define APP_USB_HID_REPORT_ID_KEYBOARD 1
+#define APP_USB_HID_REPORT_ID_CONSUMER 2
+#define APP_USB_HID_REPORT_ID_MOUSE    3
+#define APP_USB_HID_REPORT_ID_NKRO     4
+#define APP_USB_HID_REPORT_ID_COUNT    4
+
+/*
+ * Every connected peripheral gets its own set of the report IDs above,
+ * so two keyboards (or a keyboard and a mouse) never share key state.
+ * Peer 0 uses IDs 1-4, peer 1 uses IDs 5-8, and so on.
+ */
+#define APP_USB_HID_REPORT_ID(peer, kind) \
+	((peer) * APP_USB_HID_REPORT_ID_COUNT + (kind))
+#define APP_USB_HID_REPORT_ID_TOTAL \
+	(APP_USB_HID_REPORT_ID_COUNT * CONFIG_APP_MAX_PERIPHERALS)
+/* Kind (APP_USB_HID_REPORT_ID_KEYBOARD...) of a per-peer report ID */
+#define APP_USB_HID_REPORT_KIND(id) \
+	((((id) - 1) % APP_USB_HID_REPORT_ID_COUNT) + 1)
+
+/* Keyboard report (also the Boot Protocol report): 8 bytes
  * Byte 0: Modifier keys (Ctrl, Shift, Alt, GUI)
  * Byte 1: Reserved
  * Bytes 2-7: Key codes (up to 6 simultaneous keys)
  */
-#define APP_USB_HID_REPORT_SIZE 8
+#define APP_USB_HID_KEYBOARD_SIZE 8
+/* Highest usage in the key array (Logical Maximum of the descriptor) */
+#define APP_USB_HID_KEYBOARD_USAGE_MAX 0x65
+
+/* Consumer control report: 6 x 16-bit usages */
+#define APP_USB_HID_CONSUMER_SIZE 12
+
+/* Mouse report: buttons, 16-bit X/Y, wheel, pan */
+#define APP_USB_HID_MOUSE_SIZE 7
+
+/* NKRO report: modifiers, reserved, 224-bit usage bitmap */
+#define APP_USB_HID_NKRO_SIZE 30
+/* Usages in the NKRO bitmap, 0x00 to this minus one */
+#define APP_USB_HID_NKRO_USAGE_COUNT 224
+
+/* Largest report on the wire, including the report ID byte */
+#if defined(CONFIG_APP_HID_PASSTHROUGH)
+#define APP_USB_HID_REPORT_MAX_SIZE CONFIG_HID_INTERRUPT_EP_MPS
+#else
+#define APP_USB_HID_REPORT_MAX_SIZE (1 + APP_USB_HID_NKRO_SIZE)
+#endif
+
+/* Pooled report buffer, see report_pool.h */
+struct report_buf;
 
 /**
  * Initialize USB HID keyboard device
@@ -20,23 +64,139 @@
 int app_usb_hid_init(void);
 
 /**
- * Send a keyboard report over USB
- * @param report Pointer to 8-byte boot keyboard report
- * @return 0 on success, negative error code on failure
+ * Get the size of a report body
+ * @param report_id Report ID (APP_USB_HID_REPORT_ID())
+ * @return Report size without the report ID byte, 0 if the ID is unknown
  */
-int app_usb_hid_send_report(const uint8_t *report);
+uint8_t app_usb_hid_report_size(uint8_t report_id);
 
 /**
- * Release all keys (send empty report)
- * Used when BLE disconnects to prevent stuck keys
- * @return 0 on success, negative error code on failure
+ * Queue a report buffer for the USB TX thread without copying it
+ * Never blocks, safe to call from the Bluetooth RX thread. Takes over
+ * the caller's reference (see report_pool.h), also on failure; the
+ * buffer returns to the pool once the IN transfer completes.
+ * In Boot Protocol only keyboard reports are sent, without report ID.
+ * In passthrough mode any report ID and length up to the endpoint size
+ * is accepted; report ID 0 is sent without an ID byte.
+ * @param buf Report ID and body, the body length must match
+ *            app_usb_hid_report_size() unless passthrough is active
+ * @return 0 on success, -EOVERFLOW if queued by evicting an older report,
+ *         -ENOBUFS if dropped because the queue is full,
+ *         other negative error code on failure
+ */
+int app_usb_hid_submit(struct report_buf *buf);
+
+/**
+ * Copy a report into a pool buffer and queue it, see app_usb_hid_submit()
+ * @param report_id Report ID (APP_USB_HID_REPORT_ID())
+ * @param report Report body, without the report ID byte
+ * @param len Report length
+ * @param timestamp Timestamp taken when the report arrived (latency_now())
+ * @return As app_usb_hid_submit(), -ENOMEM if the pool is exhausted
+ */
+int app_usb_hid_send_report(uint8_t report_id, const uint8_t *report,
+			    uint8_t len, uint32_t timestamp);
+
+/**
+ * Check if a report matches the last one queued with its report ID
+ * The host already has such a report, it need not be sent again.
+ * @param buf Report buffer
+ * @return true if a duplicate, always false without CONFIG_APP_REPORT_COALESCE
+ */
+bool app_usb_hid_is_duplicate(const struct report_buf *buf);
+
+/**
+ * Get the number of reports merged into a newer one while USB was busy
+ * Without CONFIG_APP_REPORT_COALESCE only while the host is not polling.
+ * @return Coalesced report count
+ */
+uint32_t app_usb_hid_coalesced_count(void);
+
+/**
+ * Release all keys (send empty report for every report ID)
+ * See app_usb_hid_release_peer()
+ * @return 0
  */
 int app_usb_hid_release_all(void);
 
+/**
+ * Release all keys of one peripheral
+ * Used when a peripheral disconnects to prevent stuck keys. Never
+ * blocks and is never dropped: the empty reports go out ahead of queued
+ * reports, and reports the peer queued before the call are discarded.
+ * Same thread as app_usb_hid_submit() (Bluetooth RX).
+ * @param peer Peripheral index
+ * @return 0 on success, -EINVAL if the index is out of range
+ */
+int app_usb_hid_release_peer(uint8_t peer);
+
+/**
+ * Present a peripheral's Report Map as the USB report descriptor
+ * Re-enumerates the device when the descriptor changes. Blocks while
+ * USB restarts, call from a work item. Passthrough mode only.
+ * @param map Report Map, NULL to go back to the default descriptor
+ * @param len Report Map length
+ * @return 0 on success, negative error code on failure
+ */
+int app_usb_hid_set_report_map(const uint8_t *map, size_t len);
+
+/**
+ * Check if the peripheral's Report Map is the active descriptor
+ * @return true if reports should be passed through untouched
+ */
+bool app_usb_hid_passthrough_active(void);
+
+/**
+ * Callback type for output reports from the host, e.g. keyboard LEDs
+ * Called from the USB stack, must not block.
+ * @param report_id Report ID (APP_USB_HID_REPORT_ID()), or the peer's own
+ *                  ID in passthrough mode (0 if its map has none)
+ * @param data Report body, without the report ID byte
+ * @param len Report length
+ */
+typedef void (*app_usb_hid_output_cb_t)(uint8_t report_id, const uint8_t *data,
+					uint8_t len);
+
+/**
+ * Register the callback for output reports
+ * Without CONFIG_APP_HOST_LEDS no output reports are received.
+ * @param cb Callback
+ */
+void app_usb_hid_set_output_cb(app_usb_hid_output_cb_t cb);
+
+/**
+ * Check if the host selected Boot Protocol
+ * Only keyboard reports (6KRO layout) reach the host then.
+ * @return true in Boot Protocol, false in Report Protocol
+ */
+bool app_usb_hid_boot_protocol(void);
+
 /**
  * Check if USB HID is ready to send reports
  * @return true if ready, false otherwise
  */
 bool app_usb_hid_ready(void);
 
+/* What the host is doing with the HID IN endpoint */
+enum app_usb_hid_host_state {
+	APP_USB_HID_HOST_NOT_CONFIGURED,
+	APP_USB_HID_HOST_SUSPENDED,
+	/* Configured, but an IN transfer outlived the TX timeout */
+	APP_USB_HID_HOST_NOT_POLLING,
+	APP_USB_HID_HOST_POLLING,
+};
+
+/**
+ * Get the host state
+ * While the host is not polling, queued reports are coalesced instead
+ * of evicted; it is back to polling once the pending transfer completes.
+ * @return Host state
+ */
+enum app_usb_hid_host_state app_usb_hid_host_state(void);
+
+/**
+ * Print the host state, its measured poll time and the TX timeout
+ */
+void app_usb_hid_print_host(void);
+
 #endif /* APP_USB_HID_H_ */